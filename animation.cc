@@ -4,18 +4,39 @@ namespace std
     template<typename A, typename B> struct pair {};
     template<typename T> using optional = T*;
     using size_t = unsigned int;
+    using uint16_t = unsigned short;
+    using uint32_t = unsigned int;
+    using int16_t = short;
+    template<typename T> struct atomic {};
+    enum memory_order { memory_order_relaxed };
+    template<typename T> struct function {};
 }
 template<typename T> bool is_within(T, T, T);
-struct mat4{};
-struct vec3{};
-struct quat{};
+struct alignas(16) mat4{ float m[16]; }; // column major
+struct vec3{ float x, y, z; };
+struct quat{ float x, y, z, w; };
 
 vec3 lerp(vec3 from, vec3 to, float t);
 quat slerp(quat from, quat to, float t);
+quat nlerp(quat from, quat to, float t);
+float length(vec3);
+float angle_between(quat, quat);
 vec3 operator*(vec3, float);
 vec3 operator+(vec3, vec3);
+vec3 operator-(vec3, vec3);
 quat operator*(quat, quat);
+quat inverse(quat);
+vec3 rotate(quat, vec3);
+/// slerp the direction and lerp the length, the "vector slerp" from the root motion notes
+vec3 vector_slerp(vec3 from, vec3 to, float t);
+constexpr quat identity_quat = {0.0f, 0.0f, 0.0f, 1.0f};
 void assert(bool);
+template<typename TIt, typename TLess> void sort(TIt begin, TIt end, TLess less);
+float sqrtf(float);
+float fabsf(float);
+void* aligned_alloc(std::size_t alignment, std::size_t size);
+void free(void*);
+int printf(const char*, ...);
 
 /*
 # Dictionary
@@ -37,7 +58,7 @@ void assert(bool);
 
 struct Transform { vec3 translation; quat rotation; vec3 scale; };
 
-// todo: add "generate a pose pool" somewhere
+// pose pool: see PoseArena in the graph runtime at the end
 
 // ===========================================================================
 // SKINNING
@@ -48,7 +69,9 @@ struct Transform { vec3 translation; quat rotation; vec3 scale; };
 struct CompiledPose
 {
     /// mesh-root-space to bone-space transform
-    std::vector<mat4> transforms;
+    /// not owned, allocated from the PoseArena and only valid until the arena is reset at the end of the frame
+    mat4* transforms = nullptr;
+    std::size_t count = 0;
 };
 
 /// contain mesh, material, and per-vertex binding to matrix
@@ -59,16 +82,26 @@ struct MeshPart
 /// mesh specific bone for rendering
 struct MeshBone
 {
+    int parent; // -1 for root
+    mat4 local_bind; // used for bones that aren't in the animation skeleton until a helper solver moves them
+    mat4 inverse_bind_pose;
 };
 
+struct DeformationSolver;
+
 /** Regular mesh with animation skeleton.
  Multipart character are handled via multiple meshes since they might not reference all core bones
  */
 struct Mesh
 {
     std::vector<MeshPart> parts;
+
+    /// in any order, build_skinning_layout sorts them parent first
     std::vector<MeshBone> bones;
 
+    /// helper and rbf solvers for this mesh, owned by the mesh and run in order after the hierarchy pass
+    std::vector<DeformationSolver*> deformers;
+
 	/**
       Add
         - mapping function that take a skellington and maps to actual bones
@@ -111,6 +144,7 @@ struct Skellington
 
 
 // contain core bones in bone space
+// owns its memory, only used offline and as the reference in local_blend, the runtime uses PoseSoA from a PoseArena
 struct Pose
 {
     /// local transforms
@@ -167,6 +201,162 @@ struct Animation
 };
 
 
+// ---------------------------------------------------------------------------
+// compressed clips
+// the raw format above is what the importer produces, the streamed format is CompressedAnimation
+// * positions/scale: each animated channel is quantized to 16 bit within its own [min, min+extent] range
+// * rotations: smallest three, drop the largest component and store the other three in 48 bits
+// * constant channels (the "only serialize a constant" from above) are moved to the header
+// * frames are interleaved: all animated channels for frame N followed by frame N+1
+//   so sampling between two frames reads one contiguous block of 2*frame_stride values
+
+struct PoseSoA;
+
+/** [left down] [right passing] [right down] [left passing]
+ * a clip without markup gets a single event at 0
+*/
+struct SyncTrack
+{
+    struct Event
+    {
+        std::uint32_t id; // hashed name, same names are matched between clips
+        float start; // local time in seconds, sorted, first is 0
+    };
+
+    std::vector<Event> events;
+};
+
+/// a event as it's stored in the clip, see EventData for what is sampled
+struct ClipEvent
+{
+    float start; // local time in seconds
+    float duration; // 0 for immediate
+    std::uint32_t type; // hashed name
+    std::uint32_t payload_offset; // into event_payload
+};
+
+/// local time range in seconds, to < from if the clip looped
+struct TimeRange { float from; float to; };
+
+/// the root bone in character space, one per frame, extracted by the importer and never compressed
+struct RootMotionTrack
+{
+    std::vector<vec3> translation;
+    std::vector<quat> rotation;
+};
+
+/// root motion during a frame, relative to where the root was at the start of the frame
+struct RootMotionDelta
+{
+    vec3 translation = {0.0f, 0.0f, 0.0f};
+    quat rotation = identity_quat;
+};
+
+struct QuantizedRange { float min; float extent; };
+
+/// channels that move less than this over the whole clip are stored as a constant in the bone header
+constexpr float constant_translation_threshold = 0.00001f; // meters, well below the 16 bit step of a normal range
+constexpr float constant_scale_threshold = 0.00001f;
+constexpr float constant_rotation_threshold = 0.0001f; // radians from the first frame
+
+/// quantize value in range to [0, 65535]
+std::uint16_t quantize(float value, const QuantizedRange& range);
+float dequantize(std::uint16_t value, const QuantizedRange& range);
+
+/** smallest three: the largest component is dropped, its sign is flipped to positive (q == -q) and it's rebuilt from the rest.
+ * the others are in [-1/sqrt(2), 1/sqrt(2)] and stored in 15+15+16 bits,
+ * the 2 bit index of the dropped component is stored in the top bit of the first two values
+*/
+struct PackedQuat { std::uint16_t a; std::uint16_t b; std::uint16_t c; };
+PackedQuat pack_smallest_three(const quat& q);
+quat unpack_smallest_three(const PackedQuat& packed);
+
+struct CompressedAnimation
+{
+    /// what channels of a bone that are animated, in the same order as PoseSoA::Stream
+    enum Channel : std::uint16_t
+    {
+        animated_tx = 1 << 0, animated_ty = 1 << 1, animated_tz = 1 << 2,
+        animated_rotation = 1 << 3,
+        animated_sx = 1 << 4, animated_sy = 1 << 5, animated_sz = 1 << 6
+    };
+
+    struct Bone
+    {
+        std::uint16_t channels; // Channel flags
+        std::uint16_t first_value; // offset into a frame for the first animated value of this bone
+        Transform constant; // used by channels that aren't animated
+    };
+
+    float fps = 30.0f;
+    int frame_count = 0;
+    std::vector<Bone> bones;
+
+    /// one per animated float channel, in frame order
+    std::vector<QuantizedRange> ranges;
+
+    /// number of uint16 in a frame, an animated rotation is 3 and each animated float channel is 1
+    std::size_t frame_stride = 0;
+
+    /// frame_count * frame_stride
+    std::vector<std::uint16_t> frames;
+
+    /// same arguments as Animation::get_pose but into a SoA pose from the PoseArena
+    void get_pose(int start_index, float scaled_offset, PoseSoA* result) const;
+
+    float get_duration() const { return frame_count > 1 ? (frame_count - 1) / fps : 0.0f; }
+
+    /// see synchronization below, built by the importer from the markup
+    SyncTrack sync_track;
+
+    /// markup, sorted on start
+    std::vector<ClipEvent> events;
+
+    /// the longest duration event, sampling searches back this far for events that are still active
+    float max_event_duration = 0.0f;
+
+    /// the data pointed to by the events, owned by the clip
+    std::vector<unsigned char> event_payload;
+
+    /// empty if the clip doesn't have root motion, the root bone in the pose is then at origin
+    RootMotionTrack root_motion;
+};
+
+/// sizes and worst errors of the last compress_animation, written to the import log so animators can see what they are paying for
+struct CompressionReport
+{
+    /// the worst error of one kind and where it was
+    struct Error
+    {
+        float max = 0.0f;
+        int bone = -1;
+        int frame = -1;
+    };
+
+    std::size_t raw_bytes = 0;
+    std::size_t compressed_bytes = 0;
+    Error translation; // in meters, measured in bone space
+    Error rotation; // in radians
+    Error scale;
+};
+
+// import helpers
+int get_frame_count(const Animation&);
+QuantizedRange get_range(const std::vector<float>& track);
+std::size_t get_size_in_bytes(const AnimationData&);
+void set_constant(Animation* animation, AnimationTrack* track, const Transform& transform);
+/// decompress a single frame into a aos pose, only used to validate the compression
+void decompress_frame(const CompressedAnimation& clip, int frame, Pose* result);
+
+/// offline: moves the root bone motion from the source to result and sets the root bone to origin,
+/// call before compress_animation so the root track is stored as constants
+void extract_root_motion(Animation* source, int root_bone, RootMotionTrack* result);
+
+/// offline: run in the importer, not at runtime
+CompressedAnimation compress_animation(const Animation& source, float fps, CompressionReport* report);
+void print_report(const char* clip_name, const CompressionReport& report);
+
+
 // Two types of blending: Interpolative and Additive
 // sometime you might want to blend things globally
 
@@ -196,27 +386,595 @@ struct Blend_Additive
  */
 struct BoneMask { std::vector<float> mask; };
 
+/// the blend weight of a bone, a empty mask is 100% for all bones
+inline float calc_bone_weight(float blend_weight, const BoneMask& mask, std::size_t bone_id)
+{
+    return mask.mask.empty() ? blend_weight : blend_weight * mask.mask[bone_id];
+}
+
+/// scalar reference, see blend_soa for the one that is used at runtime, result may alias source_pose
 template<typename TBlend>
-void local_blend(Pose source_pose, Pose target_pose, float blend_weight, BoneMask mask, Pose* result)
+void local_blend(const Pose& source_pose, const Pose& target_pose, float blend_weight, const BoneMask& mask, Pose* result)
 {
-	assert(is_within(0.0f, weight, 1.0f));
+	assert(is_within(0.0f, blend_weight, 1.0f));
     assert(result != nullptr);
-    for(int bone_id: result->bone_count)
+    assert(source_pose.transforms.size() == target_pose.transforms.size());
+    assert(mask.mask.empty() || mask.mask.size() >= source_pose.transforms.size());
+
+    const std::size_t bone_count = source_pose.transforms.size();
+    result->transforms.resize(bone_count);
+    for(std::size_t bone_id = 0; bone_id < bone_count; bone_id += 1)
     {
         const float weight = calc_bone_weight(blend_weight, mask, bone_id);
         if(weight == 0)
         {
-            result->transform[bone_id] = source_pose.transform[bone_id];
+            result->transforms[bone_id] = source_pose.transforms[bone_id];
             continue;
         }
-        const auto source = source_pose.transform[bone_id];
-        const auto target = target_pose.transform[bone_id];
+        const Transform source = source_pose.transforms[bone_id];
+        const Transform& target = target_pose.transforms[bone_id];
+
+        const vec3 translation = TBlend::translation(source.translation, target.translation, weight);
+        const quat rotation = TBlend::rotation(source.rotation, target.rotation, weight);
+        const vec3 scale = TBlend::scale(source.scale, target.scale, weight);
+        result->transforms[bone_id] = {translation, rotation, scale};
+    }
+}
+
+// ===========================================================================
+// SoA pose and SIMD blending
+// crowds: 300 characters * 4 layers * 120 bones per frame, a aos Transform per bone can't be vectorized
+// so the runtime pose is one stream per component and 8 (avx2) or 4 (sse4) bones are blended at once
+// the Pose/local_blend above is kept as the reference the kernels are tested against
+
+/// lanes in the widest kernel, bone count is padded to this so no kernel needs a scalar tail
+constexpr std::size_t pose_lane_width = 8;
+
+constexpr std::size_t pad_bone_count(std::size_t bone_count)
+{
+    return (bone_count + pose_lane_width - 1) / pose_lane_width * pose_lane_width;
+}
+
+struct PoseSoA
+{
+    enum Stream { tx, ty, tz, rx, ry, rz, rw, sx, sy, sz, stream_count };
+
+    /// padded with pad_bone_count, the padding bones are identity so they can be blended like any other bone
+    std::size_t bone_count = 0;
+
+    /// stream_count * bone_count floats, 32 byte aligned, not owned (comes from the PoseArena)
+    float* data = nullptr;
+
+    float* stream(Stream s) { return data + s * bone_count; }
+    const float* stream(Stream s) const { return data + s * bone_count; }
+};
+
+float* allocate_aligned(std::size_t float_count, std::size_t alignment);
+void free_aligned(float*);
+
+void to_soa(const Pose& pose, PoseSoA* result);
+void from_soa(const PoseSoA& pose, Pose* result);
+void copy(const PoseSoA& source, PoseSoA* result);
+/// the first count bones, source and result can have different bone counts
+void copy_prefix(const PoseSoA& source, std::size_t count, PoseSoA* result);
+
+/// a bone mask with the weights premultiplied and padded, null means 1 for all bones
+struct BoneMaskSoA { const float* weights; };
+
+// one wrapper per instruction set so each kernel is only written once
+#if defined(__AVX2__)
+#include <immintrin.h>
+struct simd_float { __m256 v; };
+constexpr std::size_t simd_width = 8;
+inline simd_float simd_load(const float* p) { return {_mm256_load_ps(p)}; }
+inline void simd_store(float* p, simd_float a) { _mm256_store_ps(p, a.v); }
+inline simd_float simd_set(float f) { return {_mm256_set1_ps(f)}; }
+inline simd_float operator+(simd_float a, simd_float b) { return {_mm256_add_ps(a.v, b.v)}; }
+inline simd_float operator-(simd_float a, simd_float b) { return {_mm256_sub_ps(a.v, b.v)}; }
+inline simd_float operator*(simd_float a, simd_float b) { return {_mm256_mul_ps(a.v, b.v)}; }
+inline simd_float simd_madd(simd_float a, simd_float b, simd_float c) { return {_mm256_fmadd_ps(a.v, b.v, c.v)}; }
+inline simd_float simd_abs(simd_float a) { return {_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)}; }
+/// -1 or 1 depending on the sign bit of a
+inline simd_float simd_sign(simd_float a) { return {_mm256_or_ps(_mm256_and_ps(_mm256_set1_ps(-0.0f), a.v), _mm256_set1_ps(1.0f))}; }
+/// one newton raphson step on top of the 12 bit estimate, good enough for a quaternion that is close to normalized
+inline simd_float simd_rsqrt(simd_float a)
+{
+    const __m256 r = _mm256_rsqrt_ps(a.v);
+    return {_mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), r), _mm256_fnmadd_ps(_mm256_mul_ps(a.v, r), r, _mm256_set1_ps(3.0f)))};
+}
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+struct simd_float { __m128 v; };
+constexpr std::size_t simd_width = 4;
+inline simd_float simd_load(const float* p) { return {_mm_load_ps(p)}; }
+inline void simd_store(float* p, simd_float a) { _mm_store_ps(p, a.v); }
+inline simd_float simd_set(float f) { return {_mm_set1_ps(f)}; }
+inline simd_float operator+(simd_float a, simd_float b) { return {_mm_add_ps(a.v, b.v)}; }
+inline simd_float operator-(simd_float a, simd_float b) { return {_mm_sub_ps(a.v, b.v)}; }
+inline simd_float operator*(simd_float a, simd_float b) { return {_mm_mul_ps(a.v, b.v)}; }
+inline simd_float simd_madd(simd_float a, simd_float b, simd_float c) { return {_mm_add_ps(_mm_mul_ps(a.v, b.v), c.v)}; }
+inline simd_float simd_abs(simd_float a) { return {_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)}; }
+inline simd_float simd_sign(simd_float a) { return {_mm_or_ps(_mm_and_ps(_mm_set1_ps(-0.0f), a.v), _mm_set1_ps(1.0f))}; }
+inline simd_float simd_rsqrt(simd_float a)
+{
+    const __m128 r = _mm_rsqrt_ps(a.v);
+    return {_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), r), _mm_sub_ps(_mm_set1_ps(3.0f), _mm_mul_ps(_mm_mul_ps(a.v, r), r)))};
+}
+#else
+// scalar fallback, same kernels one bone at a time
+struct simd_float { float v; };
+constexpr std::size_t simd_width = 1;
+inline simd_float simd_load(const float* p) { return {*p}; }
+inline void simd_store(float* p, simd_float a) { *p = a.v; }
+inline simd_float simd_set(float f) { return {f}; }
+inline simd_float operator+(simd_float a, simd_float b) { return {a.v + b.v}; }
+inline simd_float operator-(simd_float a, simd_float b) { return {a.v - b.v}; }
+inline simd_float operator*(simd_float a, simd_float b) { return {a.v * b.v}; }
+inline simd_float simd_madd(simd_float a, simd_float b, simd_float c) { return {a.v * b.v + c.v}; }
+inline simd_float simd_abs(simd_float a) { return {a.v < 0 ? -a.v : a.v}; }
+inline simd_float simd_sign(simd_float a) { return {a.v < 0 ? -1.0f : 1.0f}; }
+inline simd_float simd_rsqrt(simd_float a) { return {1.0f / sqrtf(a.v)}; }
+#endif
+
+/// 4 quaternions (or 8) in registers
+struct simd_quat { simd_float x, y, z, w; };
+
+inline simd_float dot(const simd_quat& a, const simd_quat& b)
+{
+    return simd_madd(a.x, b.x, simd_madd(a.y, b.y, simd_madd(a.z, b.z, a.w * b.w)));
+}
+
+/// a * b, same order as quat operator*
+inline simd_quat mul(const simd_quat& a, const simd_quat& b)
+{
+    return
+    {
+        a.w*b.x + a.x*b.w + a.y*b.z - a.z*b.y,
+        a.w*b.y - a.x*b.z + a.y*b.w + a.z*b.x,
+        a.w*b.z + a.x*b.y - a.y*b.x + a.z*b.w,
+        a.w*b.w - a.x*b.x - a.y*b.y - a.z*b.z
+    };
+}
+
+/// shortest path nlerp
+inline simd_quat nlerp(const simd_quat& from, const simd_quat& to, simd_float t)
+{
+    // flip to so we take the short way
+    const simd_float sign = simd_sign(dot(from, to));
+    const simd_float ft = simd_set(1.0f) - t;
+    const simd_float tt = t * sign;
+    simd_quat r =
+    {
+        simd_madd(from.x, ft, to.x * tt),
+        simd_madd(from.y, ft, to.y * tt),
+        simd_madd(from.z, ft, to.z * tt),
+        simd_madd(from.w, ft, to.w * tt)
+    };
+    const simd_float inv_length = simd_rsqrt(dot(r, r));
+    return {r.x * inv_length, r.y * inv_length, r.z * inv_length, r.w * inv_length};
+}
+
+/** slerp without trig: correct t with a polynomial fitted on the angle between the quaternions and nlerp.
+ * https://zeux.io/2015/07/23/approximating-slerp/ max error is ~1e-3 radians so it's fine for helper bones at low fps
+*/
+inline simd_quat slerp(const simd_quat& from, const simd_quat& to, simd_float t)
+{
+    const simd_float d = simd_abs(dot(from, to));
+    const simd_float a = simd_madd(d, simd_madd(d, simd_madd(d, simd_set(-1.43519f), simd_set(3.55645f)), simd_set(-3.2452f)), simd_set(1.0904f));
+    const simd_float b = simd_madd(d, simd_madd(d, simd_set(0.215638f), simd_set(-1.06021f)), simd_set(0.848013f));
+    const simd_float half = t - simd_set(0.5f);
+    const simd_float k = simd_madd(a * half, half, b);
+    const simd_float corrected = simd_madd(t * half * (t - simd_set(1.0f)), k, t);
+    return nlerp(from, to, corrected);
+}
+
+inline simd_quat load_rotation(const PoseSoA& pose, std::size_t bone)
+{
+    return {simd_load(pose.stream(PoseSoA::rx) + bone), simd_load(pose.stream(PoseSoA::ry) + bone), simd_load(pose.stream(PoseSoA::rz) + bone), simd_load(pose.stream(PoseSoA::rw) + bone)};
+}
+
+inline void store_rotation(PoseSoA* pose, std::size_t bone, const simd_quat& q)
+{
+    simd_store(pose->stream(PoseSoA::rx) + bone, q.x);
+    simd_store(pose->stream(PoseSoA::ry) + bone, q.y);
+    simd_store(pose->stream(PoseSoA::rz) + bone, q.z);
+    simd_store(pose->stream(PoseSoA::rw) + bone, q.w);
+}
+
+/// SoA version of Blend_Interpolative
+struct BlendSoA_Interpolative
+{
+    static simd_quat rotation(const simd_quat& from, const simd_quat& to, simd_float t) { return slerp(from, to, t); }
+    static simd_float component(simd_float from, simd_float to, simd_float t) { return simd_madd(to - from, t, from); }
+};
+
+/// SoA version of Blend_Additive
+struct BlendSoA_Additive
+{
+    static simd_quat rotation(const simd_quat& from, const simd_quat& to, simd_float t) { return slerp(from, mul(from, to), t); }
+    static simd_float component(simd_float from, simd_float to, simd_float t) { return simd_madd(to, t, from); }
+};
+
+/** SoA version of local_blend, poses are passed by reference and result may alias source.
+ * Unlike local_blend bones with zero weight aren't special cased, a branch per bone costs more than blending them.
+*/
+template<typename TBlend>
+void blend_soa(const PoseSoA& source, const PoseSoA& target, float blend_weight, BoneMaskSoA mask, PoseSoA* result)
+{
+    assert(is_within(0.0f, blend_weight, 1.0f));
+    assert(result != nullptr);
+    assert(source.bone_count == target.bone_count && source.bone_count == result->bone_count);
+
+    const simd_float global_weight = simd_set(blend_weight);
+    for(std::size_t bone = 0; bone < result->bone_count; bone += simd_width)
+    {
+        const simd_float weight = mask.weights != nullptr ? global_weight * simd_load(mask.weights + bone) : global_weight;
+
+        // translation and scale are independent streams
+        for(auto s: {PoseSoA::tx, PoseSoA::ty, PoseSoA::tz, PoseSoA::sx, PoseSoA::sy, PoseSoA::sz})
+        {
+            simd_store(result->stream(s) + bone, TBlend::component(simd_load(source.stream(s) + bone), simd_load(target.stream(s) + bone), weight));
+        }
+
+        store_rotation(result, bone, TBlend::rotation(load_rotation(source, bone), load_rotation(target, bone), weight));
+    }
+}
+
+// benchmark: crowd of 300 characters * 4 layers * 120 bones, local_blend (aos, scalar slerp) vs blend_soa
+double now_ms();
+void print_result(const char* name, double ms);
+
+/// largest translation/scale distance or rotation angle between two poses with the same bone count
+float max_difference(const Pose& lhs, const Pose& rhs)
+{
+    float result = 0.0f;
+    const auto keep_max = [&result](float value) { result = value > result ? value : result; };
+    for(std::size_t bone = 0; bone < lhs.transforms.size(); bone += 1)
+    {
+        const Transform& a = lhs.transforms[bone];
+        const Transform& b = rhs.transforms[bone];
+        keep_max(length(a.translation - b.translation));
+        keep_max(length(a.scale - b.scale));
+        keep_max(angle_between(a.rotation, b.rotation));
+    }
+    return result;
+}
+
+void bench_pose_blending(const std::vector<Pose>& aos_poses, const std::vector<PoseSoA>& soa_poses, const BoneMask& mask, const BoneMaskSoA& soa_mask)
+{
+    constexpr int character_count = 300;
+    constexpr int layer_count = 4;
+
+    // poses are [character * (layer_count + 1)], base pose followed by one pose per layer
+    // layers alternate interpolative and additive like a normal locomotion + upper body setup
+    Pose aos_result;
+    {
+        const double start = now_ms();
+        for(int character = 0; character < character_count; character += 1)
+        {
+            const int base = character * (layer_count + 1);
+            aos_result = aos_poses[base];
+            for(int layer = 0; layer < layer_count; layer += 1)
+            {
+                const auto& layer_pose = aos_poses[base + 1 + layer];
+                if(layer % 2 == 0) { local_blend<Blend_Interpolative>(aos_result, layer_pose, 0.5f, mask, &aos_result); }
+                else { local_blend<Blend_Additive>(aos_result, layer_pose, 0.5f, mask, &aos_result); }
+            }
+        }
+        print_result("scalar local_blend", now_ms() - start);
+    }
+
+    PoseSoA soa_result;
+    soa_result.bone_count = pad_bone_count(aos_result.transforms.size());
+    soa_result.data = allocate_aligned(PoseSoA::stream_count * soa_result.bone_count, 32);
+    {
+        const double start = now_ms();
+        for(int character = 0; character < character_count; character += 1)
+        {
+            const int base = character * (layer_count + 1);
+            copy(soa_poses[base], &soa_result);
+            for(int layer = 0; layer < layer_count; layer += 1)
+            {
+                const auto& layer_pose = soa_poses[base + 1 + layer];
+                if(layer % 2 == 0) { blend_soa<BlendSoA_Interpolative>(soa_result, layer_pose, 0.5f, soa_mask, &soa_result); }
+                else { blend_soa<BlendSoA_Additive>(soa_result, layer_pose, 0.5f, soa_mask, &soa_result); }
+            }
+        }
+        print_result("simd blend_soa", now_ms() - start);
+    }
+
+    // both ends with the last character, they should match within the slerp approximation error
+    constexpr float tolerance = 1e-3f;
+    Pose from_soa_result;
+    from_soa(soa_result, &from_soa_result);
+    from_soa_result.transforms.resize(aos_result.transforms.size()); // drop the padding bones
+    const float difference = max_difference(aos_result, from_soa_result);
+    printf("scalar vs simd: max difference %f %s\n", difference, difference <= tolerance ? "ok" : "FAILED");
+    assert(difference <= tolerance);
+
+    free_aligned(soa_result.data);
+}
+
+// ===========================================================================
+// compressed clip implementation
+
+std::uint16_t quantize(float value, const QuantizedRange& range)
+{
+    if(range.extent <= 0.0f) { return 0; }
+    const float normalized = (value - range.min) / range.extent;
+    const float clamped = normalized < 0.0f ? 0.0f : (normalized > 1.0f ? 1.0f : normalized);
+    return static_cast<std::uint16_t>(clamped * 65535.0f + 0.5f);
+}
+
+float dequantize(std::uint16_t value, const QuantizedRange& range)
+{
+    return range.min + (value / 65535.0f) * range.extent;
+}
+
+namespace
+{
+    constexpr float smallest_three_range = 0.70710678f; // 1/sqrt(2)
+
+    std::uint32_t pack_unit(float value, int bits)
+    {
+        const float max = static_cast<float>((1u << bits) - 1);
+        const float normalized = (value / smallest_three_range) * 0.5f + 0.5f;
+        const float clamped = normalized < 0.0f ? 0.0f : (normalized > 1.0f ? 1.0f : normalized);
+        return static_cast<std::uint32_t>(clamped * max + 0.5f);
+    }
+
+    float unpack_unit(std::uint32_t value, int bits)
+    {
+        const float max = static_cast<float>((1u << bits) - 1);
+        return (value / max * 2.0f - 1.0f) * smallest_three_range;
+    }
+}
+
+PackedQuat pack_smallest_three(const quat& q)
+{
+    const float c[4] = {q.x, q.y, q.z, q.w};
+    int largest = 0;
+    for(int i=1; i<4; i+=1)
+    {
+        if(fabsf(c[i]) > fabsf(c[largest])) { largest = i; }
+    }
+
+    // q and -q is the same rotation so make the dropped one positive
+    const float sign = c[largest] < 0.0f ? -1.0f : 1.0f;
+    float rest[3];
+    int r = 0;
+    for(int i=0; i<4; i+=1)
+    {
+        if(i != largest) { rest[r] = c[i] * sign; r += 1; }
+    }
+
+    PackedQuat packed;
+    packed.a = static_cast<std::uint16_t>(((largest >> 1) << 15) | pack_unit(rest[0], 15));
+    packed.b = static_cast<std::uint16_t>(((largest & 1) << 15) | pack_unit(rest[1], 15));
+    packed.c = static_cast<std::uint16_t>(pack_unit(rest[2], 16));
+    return packed;
+}
+
+quat unpack_smallest_three(const PackedQuat& packed)
+{
+    const int largest = ((packed.a >> 15) << 1) | (packed.b >> 15);
+    const float rest[3] =
+    {
+        unpack_unit(packed.a & 0x7FFF, 15),
+        unpack_unit(packed.b & 0x7FFF, 15),
+        unpack_unit(packed.c, 16)
+    };
+    const float sum = rest[0]*rest[0] + rest[1]*rest[1] + rest[2]*rest[2];
+    const float dropped = sum >= 1.0f ? 0.0f : sqrtf(1.0f - sum);
+
+    float c[4];
+    int r = 0;
+    for(int i=0; i<4; i+=1)
+    {
+        if(i == largest) { c[i] = dropped; }
+        else { c[i] = rest[r]; r += 1; }
+    }
+    return quat{c[0], c[1], c[2], c[3]};
+}
+
+void CompressedAnimation::get_pose(int start_index, float scaled_offset, PoseSoA* result) const
+{
+    assert(result != nullptr);
+    assert(start_index >= 0 && start_index < frame_count);
+    // a lod pose might only have the first bones, the rest are skipped
+    const std::size_t bone_count = bones.size() < result->bone_count ? bones.size() : result->bone_count;
+
+    // the two frames are next to each other, this is the only memory from the clip we touch apart from the header
+    const std::uint16_t* from = frames.data() + start_index * frame_stride;
+    const std::uint16_t* to = start_index + 1 < frame_count ? from + frame_stride : from;
+
+    // ranges are in frame order so we can walk them with the values
+    std::size_t range_index = 0;
+    for(std::size_t bone_index = 0; bone_index < bone_count; bone_index += 1)
+    {
+        const Bone& bone = bones[bone_index];
+        std::size_t value = bone.first_value;
+
+        auto sample_channel = [&](std::uint16_t flag, float constant, PoseSoA::Stream stream)
+        {
+            float v = constant;
+            if(bone.channels & flag)
+            {
+                const QuantizedRange& range = ranges[range_index];
+                const float a = dequantize(from[value], range);
+                const float b = dequantize(to[value], range);
+                v = a + (b - a) * scaled_offset;
+                range_index += 1;
+                value += 1;
+            }
+            result->stream(stream)[bone_index] = v;
+        };
+
+        sample_channel(animated_tx, bone.constant.translation.x, PoseSoA::tx);
+        sample_channel(animated_ty, bone.constant.translation.y, PoseSoA::ty);
+        sample_channel(animated_tz, bone.constant.translation.z, PoseSoA::tz);
+
+        quat rotation = bone.constant.rotation;
+        if(bone.channels & animated_rotation)
+        {
+            const quat a = unpack_smallest_three({from[value], from[value+1], from[value+2]});
+            const quat b = unpack_smallest_three({to[value], to[value+1], to[value+2]});
+            // nlerp is fine between two neighbouring keyframes
+            rotation = nlerp(a, b, scaled_offset);
+            value += 3;
+        }
+        result->stream(PoseSoA::rx)[bone_index] = rotation.x;
+        result->stream(PoseSoA::ry)[bone_index] = rotation.y;
+        result->stream(PoseSoA::rz)[bone_index] = rotation.z;
+        result->stream(PoseSoA::rw)[bone_index] = rotation.w;
+
+        sample_channel(animated_sx, bone.constant.scale.x, PoseSoA::sx);
+        sample_channel(animated_sy, bone.constant.scale.y, PoseSoA::sy);
+        sample_channel(animated_sz, bone.constant.scale.z, PoseSoA::sz);
+    }
+
+    // bones the clip doesn't have, including the padding, are identity so they blend like any other bone
+    for(std::size_t bone_index = bone_count; bone_index < result->bone_count; bone_index += 1)
+    {
+        for(auto s: {PoseSoA::tx, PoseSoA::ty, PoseSoA::tz, PoseSoA::rx, PoseSoA::ry, PoseSoA::rz}) { result->stream(s)[bone_index] = 0.0f; }
+        for(auto s: {PoseSoA::rw, PoseSoA::sx, PoseSoA::sy, PoseSoA::sz}) { result->stream(s)[bone_index] = 1.0f; }
+    }
+}
+
+CompressedAnimation compress_animation(const Animation& source, float fps, CompressionReport* report)
+{
+    CompressedAnimation clip;
+    clip.fps = fps;
+    clip.frame_count = get_frame_count(source);
+
+    // pass 1: figure out what channels are animated and the range of each one
+    // a channel that moves less than the constant thresholds over the whole clip is stored as a constant
+    for(std::size_t bone_index = 0; bone_index < source.tracks.size(); bone_index += 1)
+    {
+        const AnimationTrack& track = source.tracks[bone_index];
+        CompressedAnimation::Bone bone;
+        bone.channels = 0;
+        bone.first_value = static_cast<std::uint16_t>(clip.frame_stride);
+        bone.constant = track.get_transform(source.data, 0, 0.0f);
+
+        auto add_float = [&](const AnimationTrack::Data& data, std::uint16_t flag, float threshold, float* constant)
+        {
+            if(data.single) { return; }
+            const QuantizedRange range = get_range(source.data.float_tracks[data.index]);
+            if(range.extent <= threshold)
+            {
+                // the middle of the range halves the error compared to the first frame
+                *constant = range.min + range.extent * 0.5f;
+                return;
+            }
+            bone.channels |= flag;
+            clip.ranges.push_back(range);
+            clip.frame_stride += 1;
+        };
+
+        auto is_rotation_animated = [&]()
+        {
+            if(track.rotation.single) { return false; }
+            for(int frame = 1; frame < clip.frame_count; frame += 1)
+            {
+                const quat rotation = track.get_transform(source.data, frame, 0.0f).rotation;
+                if(angle_between(bone.constant.rotation, rotation) > constant_rotation_threshold) { return true; }
+            }
+            return false;
+        };
+
+        add_float(track.pos_x, CompressedAnimation::animated_tx, constant_translation_threshold, &bone.constant.translation.x);
+        add_float(track.pos_y, CompressedAnimation::animated_ty, constant_translation_threshold, &bone.constant.translation.y);
+        add_float(track.pos_z, CompressedAnimation::animated_tz, constant_translation_threshold, &bone.constant.translation.z);
+        if(is_rotation_animated())
+        {
+            bone.channels |= CompressedAnimation::animated_rotation;
+            clip.frame_stride += 3;
+        }
+        add_float(track.scale_x, CompressedAnimation::animated_sx, constant_scale_threshold, &bone.constant.scale.x);
+        add_float(track.scale_y, CompressedAnimation::animated_sy, constant_scale_threshold, &bone.constant.scale.y);
+        add_float(track.scale_z, CompressedAnimation::animated_sz, constant_scale_threshold, &bone.constant.scale.z);
+
+        clip.bones.push_back(bone);
+    }
+
+    // pass 2: write the interleaved frames, same order as get_pose reads them
+    clip.frames.resize(clip.frame_count * clip.frame_stride);
+    for(int frame = 0; frame < clip.frame_count; frame += 1)
+    {
+        std::uint16_t* out = clip.frames.data() + frame * clip.frame_stride;
+        std::size_t range_index = 0;
+        for(std::size_t bone_index = 0; bone_index < clip.bones.size(); bone_index += 1)
+        {
+            const auto& bone = clip.bones[bone_index];
+            const Transform t = source.tracks[bone_index].get_transform(source.data, frame, 0.0f);
+            std::size_t value = bone.first_value;
+
+            auto write_float = [&](std::uint16_t flag, float v)
+            {
+                if((bone.channels & flag) == 0) { return; }
+                out[value] = quantize(v, clip.ranges[range_index]);
+                range_index += 1;
+                value += 1;
+            };
+
+            write_float(CompressedAnimation::animated_tx, t.translation.x);
+            write_float(CompressedAnimation::animated_ty, t.translation.y);
+            write_float(CompressedAnimation::animated_tz, t.translation.z);
+            if(bone.channels & CompressedAnimation::animated_rotation)
+            {
+                const PackedQuat packed = pack_smallest_three(t.rotation);
+                out[value] = packed.a; out[value+1] = packed.b; out[value+2] = packed.c;
+                value += 3;
+            }
+            write_float(CompressedAnimation::animated_sx, t.scale.x);
+            write_float(CompressedAnimation::animated_sy, t.scale.y);
+            write_float(CompressedAnimation::animated_sz, t.scale.z);
+        }
+    }
 
-        const auto translation = TBlend::translation(source.translation, target.translation, weight);
-        const auto rotation = TBlend::rotation(source.rotation, target.rotation, weight);
-        const auto scale = TBlend::scale(source.scale, target.scale, weight);
-        result->transform[bone_id] = {translation, rotation, scale};
+    // pass 3: decompress every frame and compare with the source to get the error report
+    if(report != nullptr)
+    {
+        *report = CompressionReport{};
+        report->raw_bytes = get_size_in_bytes(source.data);
+        report->compressed_bytes = clip.frames.size() * sizeof(std::uint16_t)
+            + clip.ranges.size() * sizeof(QuantizedRange)
+            + clip.bones.size() * sizeof(CompressedAnimation::Bone);
+
+        Pose decompressed;
+        for(int frame = 0; frame < clip.frame_count; frame += 1)
+        {
+            decompress_frame(clip, frame, &decompressed);
+            for(std::size_t bone_index = 0; bone_index < clip.bones.size(); bone_index += 1)
+            {
+                const Transform expected = source.tracks[bone_index].get_transform(source.data, frame, 0.0f);
+                const Transform& actual = decompressed.transforms[bone_index];
+                auto add_error = [&](CompressionReport::Error* error, float value)
+                {
+                    if(value <= error->max) { return; }
+                    error->max = value;
+                    error->bone = static_cast<int>(bone_index);
+                    error->frame = frame;
+                };
+                add_error(&report->translation, length(expected.translation - actual.translation));
+                add_error(&report->rotation, angle_between(expected.rotation, actual.rotation));
+                add_error(&report->scale, length(expected.scale - actual.scale));
+            }
+        }
     }
+
+    return clip;
+}
+
+void print_report(const char* clip_name, const CompressionReport& report)
+{
+    printf("%s: %zu -> %zu bytes (%.1f%%)\n", clip_name, report.raw_bytes, report.compressed_bytes,
+        report.raw_bytes > 0 ? 100.0 * report.compressed_bytes / report.raw_bytes : 0.0);
+    printf("  max error: translation %.5fm (bone %d, frame %d), rotation %.5frad (bone %d, frame %d), scale %.5f (bone %d, frame %d)\n",
+        report.translation.max, report.translation.bone, report.translation.frame,
+        report.rotation.max, report.rotation.bone, report.rotation.frame,
+        report.scale.max, report.scale.bone, report.scale.frame);
 }
 
 // extract root motion: essentially just taking 2 positions and getting the delta
@@ -252,8 +1010,9 @@ void local_blend(Pose source_pose, Pose target_pose, float blend_weight, BoneMas
 // when sampling all events during the update are returned
 struct EventData
 {
-    Animation* source_animation;
-    void* data;
+    const CompressedAnimation* source_animation;
+    std::uint32_t type;
+    const void* data; // points into the source_animation event_payload
     float weight; // start out as 1, changed by blending
     float percentage; // position of end point, 0-1, 1 for immediate
     // metadata
@@ -261,6 +1020,7 @@ struct EventData
     bool trigged_by_leaving_branch; // we are transitioning away from the animaiton that triggered this event
 };
 
+// events are collected in a EventRing, see the runtime at the end
 // at the end of the frame forward events to consumers
 // trigger sfx/vfx, enable show/hide meshes, spawn objects, change damage shape
 // consumer can reason about what should be done, multiple foot events -> only triggger highest
@@ -290,3 +1050,1546 @@ struct EventData
 // can recalc if target is moving
 
 // can use motion warping to fix motion matching
+
+
+// ===========================================================================
+// ANIMATION GRAPH RUNTIME
+// the graph is what gameplay/animators build: sample, blend, additive, masked layer and ik nodes
+// walking it as a tree each frame means recursion and a pose per node, so when the graph changes it's compiled into
+// a linear list of tasks that read and write pose "registers", a register is reused as soon as its pose is consumed
+// (a 4 layer graph needs 2 poses instead of 9)
+// characters are independent so the task lists are run in parallel, one character per job
+
+// same as core::WorkerPool in entity.cc
+struct WorkerPool
+{
+    std::size_t get_worker_count() const;
+
+    /// 0 for the thread that called run(), 1 to worker count for the workers
+    static std::size_t get_thread_index();
+
+    /// call job(index) for each index in [0, count), blocks until all jobs are done
+    void run(std::size_t count, const std::function<void (std::size_t)>& job);
+};
+
+struct MotionWarp;
+
+/// implemented by gameplay (foot placement, look at, hand on lever...)
+struct IkSolver
+{
+    virtual ~IkSolver() = default;
+
+    /// modify the pose in place, called after the input has been evaluated
+    virtual void solve(PoseSoA* pose) = 0;
+};
+
+enum class AnimNodeType { reference_pose, sample, blend, additive, masked_blend, ik };
+
+struct AnimNode
+{
+    AnimNodeType type;
+
+    /// source and target for the blends, source for ik, unused for the rest
+    int inputs[2] = {-1, -1};
+
+    // parameters, gameplay can change these each frame without recompiling
+    const CompressedAnimation* clip = nullptr; // sample
+    float time = 0.0f; // sample, in seconds, events since the time of the last evaluate are sampled, see AnimCharacter::sampled
+    float weight = 0.0f; // blend, additive and masked_blend
+    BoneMaskSoA mask = {nullptr}; // masked_blend
+    IkSolver* ik = nullptr; // ik
+};
+
+struct AnimGraph
+{
+    std::vector<AnimNode> nodes;
+    int root = -1;
+};
+
+/// registers are indices into the poses acquired for a character
+constexpr std::size_t max_anim_registers = 16;
+
+struct AnimTask
+{
+    AnimNodeType type;
+    std::uint16_t node;
+    std::uint8_t result;
+    std::uint8_t inputs[2];
+};
+
+struct AnimTaskList
+{
+    std::vector<AnimTask> tasks;
+    std::size_t register_count = 0;
+    std::uint8_t output = 0;
+};
+
+/// call when the graph structure changes, changing parameters doesn't require a recompile
+AnimTaskList compile_graph(const AnimGraph& graph);
+
+/// number of allocate_aligned calls, should not change after loading
+std::size_t get_pose_allocation_count();
+
+/** per frame memory for poses and matrix palettes, one per thread so allocating doesn't need a lock.
+ * All memory is allocated up front, allocating is a bump of a index and everything is freed at once with reset().
+ * Pose buffers are sized for the largest skeleton, a smaller skeleton just uses a smaller stride.
+*/
+struct PoseArena
+{
+    PoseArena(std::size_t max_bone_count, std::size_t pose_capacity, std::size_t matrix_capacity);
+    ~PoseArena();
+
+    PoseArena(const PoseArena&) = delete;
+    void operator=(const PoseArena&) = delete;
+
+    /// valid until reset
+    PoseSoA allocate_pose(std::size_t bone_count);
+    CompiledPose allocate_palette(std::size_t bone_count);
+
+    /// O(1), call at the end of the frame when skinning is done with the poses
+    void reset();
+
+    std::size_t max_bone_count; // padded
+    std::size_t pose_capacity;
+    std::size_t matrix_capacity;
+
+    float* pose_memory; // pose_capacity * PoseSoA::stream_count * max_bone_count
+    mat4* matrix_memory; // matrix_capacity
+
+    std::size_t used_poses = 0;
+    std::size_t used_matrices = 0;
+
+    /// the most used in a single frame, use this to tune the capacity
+    std::size_t peak_poses = 0;
+    std::size_t peak_matrices = 0;
+};
+
+/// a range in a EventRing, indices are not wrapped
+struct EventSpan { std::uint32_t begin = 0; std::uint32_t end = 0; };
+
+/** Per thread events for the frame.
+ * Sampling copies the events straight from the clips into the ring, blend nodes scale the weights of the spans in place
+ * and consumers read everything at the end of the frame. Fixed capacity, nothing is allocated after creation.
+*/
+struct EventRing
+{
+    explicit EventRing(std::size_t capacity_power_of_two);
+
+    EventRing(const EventRing&) = delete;
+    void operator=(const EventRing&) = delete;
+
+    EventData& at(std::uint32_t index) { return events[index & mask]; }
+
+    /// reserve room for count events at the end, returns the index of the first
+    std::uint32_t push(std::size_t count);
+
+    void scale_weights(const EventSpan& span, float weight);
+
+    /// call consumer(const EventData* events, std::size_t count) with everything pushed since the last consume
+    /// at most two calls since the ring might have wrapped
+    template<typename TConsumer> void consume(TConsumer consumer);
+
+    std::vector<EventData> events;
+    std::uint32_t mask;
+    std::uint32_t read = 0;
+    std::uint32_t write = 0;
+};
+
+/// copy all events in [range.from, range.to) from the clip to the ring, returns what was added
+EventSpan sample_events(const CompressedAnimation& clip, TimeRange range, EventRing* ring);
+
+// ---------------------------------------------------------------------------
+// lod
+// far away characters sample at 1/2 or 1/4 rate and extrapolate the frames in between, skip leaf/facial/cape bones
+// and skip the deformation solvers when building the palette. events and root motion are still evaluated every frame
+
+enum class AnimLod { full, half_rate, quarter_rate, far };
+constexpr std::size_t anim_lod_count = 4;
+
+struct AnimLodSettings
+{
+    int period; // evaluate the pose every n frames
+    bool helper_solvers;
+    bool rbf_solvers;
+};
+
+constexpr AnimLodSettings anim_lod_settings[anim_lod_count] =
+{
+    {1, true, true}, // full
+    {2, true, true}, // half_rate
+    {4, true, false}, // quarter_rate
+    {4, false, false} // far
+};
+
+/** the bones to evaluate per lod, built from a BoneMask per lod when the skeleton is loaded.
+ * The importer sorts the bones so the ones that are dropped first (fingers, face, cape) are last,
+ * each lod is then a prefix so the soa kernels just run on fewer bones
+*/
+struct AnimLodSkeleton
+{
+    std::size_t bone_count[anim_lod_count];
+};
+
+/// lod_masks has anim_lod_count masks, a bone is kept if the weight is > 0
+AnimLodSkeleton build_lod_skeleton(const BoneMask* lod_masks);
+
+/// translation/scale is extrapolated linearly and rotation with nlerp, t is 1 at last and larger after
+void extrapolate_soa(const PoseSoA& previous, const PoseSoA& last, float t, PoseSoA* result);
+
+struct AnimCharacter
+{
+    AnimGraph graph;
+    AnimTaskList tasks;
+
+    /// set when the graph structure has changed, the task list is recompiled before the next evaluate
+    bool graph_changed = true;
+
+    /// per graph node, the local time range a sample node covered in the last evaluate, to is where the next one starts
+    std::vector<TimeRange> sampled;
+
+    const PoseSoA* reference_pose = nullptr;
+    std::size_t bone_count = 0;
+
+    /// the final local pose, read by skinning, from the arena so only valid until the end of the frame
+    PoseSoA output;
+
+    /// the events sampled this frame, blend weighted, valid until the rings are consumed
+    EventRing* event_ring = nullptr;
+    EventSpan events;
+
+    /// blended root motion for this frame, gameplay decides if it's used (anim driven) or ignored
+    RootMotionDelta root_motion;
+
+    /// set by gameplay to steer root motion towards a target, see MotionWarp
+    MotionWarp* warp = nullptr;
+
+    // lod, set by the AnimLodScheduler
+    vec3 position; // world space, set by gameplay
+    AnimLod lod = AnimLod::full;
+    int lod_phase = 0; // spreads the reduced rate characters over the frames
+    const AnimLodSkeleton* lod_skeleton = nullptr; // null to always evaluate all bones
+
+    /// the last two evaluated poses, persistent (not from the arena), used to extrapolate the skipped frames
+    PoseSoA history[2];
+    long long history_frame[2] = {-1000, -1000};
+};
+
+/// allocate the lod history, counted by get_pose_allocation_count, call when the character is spawned
+void create_lod_history(AnimCharacter* character);
+void destroy_lod_history(AnimCharacter* character);
+
+/** Picks a lod for each character from the distance to the camera and then lowers the lod of the characters furthest
+ * away until the number of bones evaluated per frame is within the budget.
+*/
+struct AnimLodScheduler
+{
+    float distances[anim_lod_count - 1] = {10.0f, 25.0f, 50.0f}; // half_rate, quarter_rate and far starts at
+    std::size_t bone_budget = 20000; // per frame
+
+    /// reused so scheduling doesn't allocate after the first frame
+    std::vector<std::uint32_t> order;
+    std::vector<float> distance_squared;
+
+    /// bones the scheduled characters will evaluate per frame (on average over the lod periods)
+    std::size_t scheduled_bones = 0;
+
+    void schedule(AnimCharacter* characters, std::size_t count, const vec3& camera);
+};
+
+struct AnimTaskOutput
+{
+    /// null to skip the pose and only evaluate events and root motion (a frame that is extrapolated)
+    PoseSoA* pose;
+
+    /// the first bones that are evaluated, the rest are left as the reference pose
+    std::size_t bone_count;
+
+    EventSpan* events;
+    RootMotionDelta* root_motion;
+};
+
+/// sampled is one per graph node, a sample task samples events and root motion from the end of its range to the node time and stores the new range
+void execute(const AnimTaskList& list, const AnimGraph& graph, const PoseSoA& reference_pose, PoseArena* arena, EventRing* ring, TimeRange* sampled, const AnimTaskOutput& output);
+
+// root motion, see ROOT MOTION below
+RootMotionDelta sample_root_motion(const CompressedAnimation& clip, TimeRange range);
+RootMotionDelta blend_root_motion(const RootMotionDelta& from, const RootMotionDelta& to, float weight);
+RootMotionDelta add_root_motion(const RootMotionDelta& base, const RootMotionDelta& layer, float weight);
+void solve_motion_warps(AnimCharacter* characters, std::size_t count, WorkerPool* workers);
+
+/// arenas and rings has one per thread in workers (worker count + 1)
+void evaluate_characters(AnimCharacter* characters, std::size_t count, PoseArena* arenas, EventRing* rings, WorkerPool* workers, long long frame);
+
+/// returns the number of pose allocations during the frame and asserts that it's 0 since the arenas are fixed size
+/// (a changed graph recompiles its task list which allocates but isn't counted, that's not every frame)
+std::size_t update_animation(AnimCharacter* characters, std::size_t count, PoseArena* arenas, EventRing* rings, WorkerPool* workers, long long frame);
+
+/// consumer is called in bulk with all the events for the frame, see EventRing::consume
+template<typename TConsumer>
+void end_animation_frame(PoseArena* arenas, EventRing* rings, std::size_t count, TConsumer consumer);
+
+
+// ---------------------------------------------------------------------------
+// graph compiler
+
+namespace
+{
+    struct GraphCompiler
+    {
+        const AnimGraph& graph;
+        AnimTaskList* list;
+        std::vector<std::uint8_t> free_registers;
+
+        std::uint8_t allocate()
+        {
+            if(free_registers.empty() == false)
+            {
+                const std::uint8_t r = free_registers.back();
+                free_registers.pop_back();
+                return r;
+            }
+            assert(list->register_count < max_anim_registers);
+            list->register_count += 1;
+            return static_cast<std::uint8_t>(list->register_count - 1);
+        }
+
+        void release(std::uint8_t r) { free_registers.push_back(r); }
+
+        /// post order, returns the register the result ends up in
+        // todo(Gustav): emit the deepest input first (sethi-ullman) to use fewer registers for unbalanced graphs
+        std::uint8_t emit(int node_index)
+        {
+            assert(node_index >= 0 && node_index < static_cast<int>(graph.nodes.size()));
+            const AnimNode& node = graph.nodes[node_index];
+
+            AnimTask task;
+            task.type = node.type;
+            task.node = static_cast<std::uint16_t>(node_index);
+            task.inputs[0] = task.inputs[1] = 0;
+
+            switch(node.type)
+            {
+            case AnimNodeType::reference_pose:
+            case AnimNodeType::sample:
+                task.result = allocate();
+                break;
+            case AnimNodeType::ik:
+                // solved in place
+                task.inputs[0] = emit(node.inputs[0]);
+                task.result = task.inputs[0];
+                break;
+            case AnimNodeType::blend:
+            case AnimNodeType::additive:
+            case AnimNodeType::masked_blend:
+                // blend_soa allows result to alias source so only the target register is freed
+                task.inputs[0] = emit(node.inputs[0]);
+                task.inputs[1] = emit(node.inputs[1]);
+                task.result = task.inputs[0];
+                release(task.inputs[1]);
+                break;
+            }
+
+            list->tasks.push_back(task);
+            return task.result;
+        }
+    };
+}
+
+AnimTaskList compile_graph(const AnimGraph& graph)
+{
+    AnimTaskList list;
+    if(graph.root < 0) { return list; }
+
+    GraphCompiler compiler{graph, &list, {}};
+    list.output = compiler.emit(graph.root);
+    return list;
+}
+
+
+// ---------------------------------------------------------------------------
+// pose arena
+
+namespace
+{
+    // relaxed is enough, it's only compared between frames
+    std::atomic<std::size_t> pose_allocation_count = 0;
+}
+
+std::size_t get_pose_allocation_count()
+{
+    return pose_allocation_count.load(std::memory_order_relaxed);
+}
+
+float* allocate_aligned(std::size_t float_count, std::size_t alignment)
+{
+    pose_allocation_count.fetch_add(1, std::memory_order_relaxed);
+
+    // aligned_alloc wants the size to be a multiple of the alignment
+    const std::size_t bytes = (float_count * sizeof(float) + alignment - 1) / alignment * alignment;
+    return static_cast<float*>(aligned_alloc(alignment, bytes));
+}
+
+void free_aligned(float* memory)
+{
+    free(memory);
+}
+
+PoseArena::PoseArena(std::size_t bone_count, std::size_t poses, std::size_t matrices)
+    : max_bone_count(pad_bone_count(bone_count))
+    , pose_capacity(poses)
+    , matrix_capacity(matrices)
+    , pose_memory(allocate_aligned(poses * PoseSoA::stream_count * pad_bone_count(bone_count), 32))
+    , matrix_memory(reinterpret_cast<mat4*>(allocate_aligned(matrices * 16, 32)))
+{
+}
+
+PoseArena::~PoseArena()
+{
+    free_aligned(pose_memory);
+    free_aligned(reinterpret_cast<float*>(matrix_memory));
+}
+
+PoseSoA PoseArena::allocate_pose(std::size_t bone_count)
+{
+    assert(bone_count <= max_bone_count);
+    // fixed capacity, increase it instead of growing. peak_poses tells you what you need
+    assert(used_poses < pose_capacity);
+
+    PoseSoA pose;
+    pose.bone_count = bone_count;
+    pose.data = pose_memory + used_poses * PoseSoA::stream_count * max_bone_count;
+    used_poses += 1;
+    peak_poses = used_poses > peak_poses ? used_poses : peak_poses;
+    return pose;
+}
+
+CompiledPose PoseArena::allocate_palette(std::size_t bone_count)
+{
+    assert(used_matrices + bone_count <= matrix_capacity);
+
+    CompiledPose palette;
+    palette.transforms = matrix_memory + used_matrices;
+    palette.count = bone_count;
+    used_matrices += bone_count;
+    peak_matrices = used_matrices > peak_matrices ? used_matrices : peak_matrices;
+    return palette;
+}
+
+void PoseArena::reset()
+{
+    used_poses = 0;
+    used_matrices = 0;
+}
+
+
+// ---------------------------------------------------------------------------
+// events
+
+EventRing::EventRing(std::size_t capacity)
+    : mask(static_cast<std::uint32_t>(capacity - 1))
+{
+    assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+    events.resize(capacity);
+}
+
+std::uint32_t EventRing::push(std::size_t count)
+{
+    // fixed capacity, consumers must keep up. increase the capacity if this triggers
+    assert(write - read + count <= events.size());
+    const std::uint32_t first = write;
+    write += static_cast<std::uint32_t>(count);
+    return first;
+}
+
+void EventRing::scale_weights(const EventSpan& span, float weight)
+{
+    for(std::uint32_t index = span.begin; index != span.end; index += 1)
+    {
+        at(index).weight *= weight;
+    }
+}
+
+template<typename TConsumer>
+void EventRing::consume(TConsumer consumer)
+{
+    const std::uint32_t count = write - read;
+    const std::uint32_t first = read & mask;
+    const std::uint32_t until_end = static_cast<std::uint32_t>(events.size()) - first;
+    if(count <= until_end)
+    {
+        if(count > 0) { consumer(events.data() + first, count); }
+    }
+    else
+    {
+        consumer(events.data() + first, until_end);
+        consumer(events.data(), count - until_end);
+    }
+    read = write;
+}
+
+namespace
+{
+    /// first event that starts at or after time
+    std::size_t lower_bound_event(const std::vector<ClipEvent>& events, float time)
+    {
+        std::size_t first = 0;
+        std::size_t count = events.size();
+        while(count > 0)
+        {
+            const std::size_t step = count / 2;
+            if(events[first + step].start < time)
+            {
+                first += step + 1;
+                count -= step + 1;
+            }
+            else
+            {
+                count = step;
+            }
+        }
+        return first;
+    }
+
+    EventSpan sample_events_in_range(const CompressedAnimation& clip, float from, float to, EventRing* ring)
+    {
+        // a duration event that started before from might still be active, search back the longest duration
+        // the filter is only needed for that part, everything in [from, to) is copied as is
+        const std::size_t first_active = lower_bound_event(clip.events, from - clip.max_event_duration);
+        const std::size_t first = lower_bound_event(clip.events, from);
+        const std::size_t last = lower_bound_event(clip.events, to);
+
+        std::size_t active_count = 0;
+        for(std::size_t index = first_active; index < first; index += 1)
+        {
+            const ClipEvent& e = clip.events[index];
+            if(e.start + e.duration > from) { active_count += 1; }
+        }
+
+        EventSpan span;
+        span.begin = ring->push(active_count + (last - first));
+        span.end = span.begin + static_cast<std::uint32_t>(active_count + (last - first));
+
+        auto write_event = [&](std::uint32_t ring_index, const ClipEvent& e)
+        {
+            EventData& data = ring->at(ring_index);
+            data.source_animation = &clip;
+            data.type = e.type;
+            data.data = clip.event_payload.data() + e.payload_offset;
+            data.weight = 1.0f;
+            data.percentage = e.duration > 0.0f ? (to - e.start) / e.duration : 1.0f;
+            data.percentage = data.percentage > 1.0f ? 1.0f : data.percentage;
+            data.ignored = false;
+            data.trigged_by_leaving_branch = false;
+        };
+
+        std::uint32_t ring_index = span.begin;
+        for(std::size_t index = first_active; index < first; index += 1)
+        {
+            const ClipEvent& e = clip.events[index];
+            if(e.start + e.duration > from) { write_event(ring_index, e); ring_index += 1; }
+        }
+        for(std::size_t index = first; index < last; index += 1)
+        {
+            write_event(ring_index, clip.events[index]);
+            ring_index += 1;
+        }
+
+        return span;
+    }
+}
+
+EventSpan sample_events(const CompressedAnimation& clip, TimeRange range, EventRing* ring)
+{
+    if(range.to >= range.from)
+    {
+        return sample_events_in_range(clip, range.from, range.to, ring);
+    }
+
+    // looped, the two spans are next to each other in the ring
+    const EventSpan end = sample_events_in_range(clip, range.from, clip.get_duration() + 0.0001f, ring);
+    const EventSpan start = sample_events_in_range(clip, 0.0f, range.to, ring);
+    return {end.begin, start.end};
+}
+
+
+// ---------------------------------------------------------------------------
+// evaluation
+
+void execute(const AnimTaskList& list, const AnimGraph& graph, const PoseSoA& reference_pose, PoseArena* arena, EventRing* ring, TimeRange* sampled, const AnimTaskOutput& output)
+{
+    assert(list.register_count <= max_anim_registers);
+    const bool evaluate_pose = output.pose != nullptr;
+
+    // the registers are only needed during this call but returning them would need a free list,
+    // they are a few kb per character so they are left until the arena is reset
+    PoseSoA registers[max_anim_registers];
+    if(evaluate_pose)
+    {
+        for(std::size_t r = 0; r < list.register_count; r += 1)
+        {
+            registers[r] = arena->allocate_pose(pad_bone_count(output.bone_count));
+        }
+    }
+
+    // the events that ended up in each register, the tasks are post order so the events for the
+    // inputs of a blend are always next to each other in the ring and can be merged into one span
+    EventSpan events[max_anim_registers];
+
+    // same for root motion, blended along with the pose
+    RootMotionDelta root_motion[max_anim_registers];
+
+    for(const AnimTask& task: list.tasks)
+    {
+        const AnimNode& node = graph.nodes[task.node];
+        PoseSoA* result = &registers[task.result];
+        switch(task.type)
+        {
+        case AnimNodeType::reference_pose:
+            if(evaluate_pose) { copy_prefix(reference_pose, result->bone_count, result); }
+            events[task.result] = {ring->write, ring->write};
+            root_motion[task.result] = RootMotionDelta{};
+            break;
+        case AnimNodeType::sample:
+            {
+                const float frame = node.time * node.clip->fps;
+                int start_index = static_cast<int>(frame);
+                float offset = frame - start_index;
+                if(start_index >= node.clip->frame_count - 1) { start_index = node.clip->frame_count - 1; offset = 0.0f; }
+                if(evaluate_pose) { node.clip->get_pose(start_index, offset, result); }
+
+                // gameplay or a sync blend only sets the time, where the last frame ended is runtime state
+                const TimeRange range = {sampled[task.node].to, node.time};
+                sampled[task.node] = range;
+                events[task.result] = sample_events(*node.clip, range, ring);
+                root_motion[task.result] = sample_root_motion(*node.clip, range);
+            }
+            break;
+        case AnimNodeType::blend:
+        case AnimNodeType::additive:
+        case AnimNodeType::masked_blend:
+            {
+                const EventSpan source_events = events[task.inputs[0]];
+                const EventSpan target_events = events[task.inputs[1]];
+                assert(source_events.end == target_events.begin);
+
+                const RootMotionDelta& source_motion = root_motion[task.inputs[0]];
+                const RootMotionDelta& target_motion = root_motion[task.inputs[1]];
+
+                if(task.type == AnimNodeType::blend)
+                {
+                    if(evaluate_pose) { blend_soa<BlendSoA_Interpolative>(registers[task.inputs[0]], registers[task.inputs[1]], node.weight, {nullptr}, result); }
+                    ring->scale_weights(source_events, 1.0f - node.weight);
+                    root_motion[task.result] = blend_root_motion(source_motion, target_motion, node.weight);
+                }
+                else if(task.type == AnimNodeType::additive)
+                {
+                    if(evaluate_pose) { blend_soa<BlendSoA_Additive>(registers[task.inputs[0]], registers[task.inputs[1]], node.weight, {nullptr}, result); }
+                    root_motion[task.result] = add_root_motion(source_motion, target_motion, node.weight);
+                }
+                else
+                {
+                    // masked layers (upper body...) don't contribute root motion, the root isn't in the mask
+                    if(evaluate_pose) { blend_soa<BlendSoA_Interpolative>(registers[task.inputs[0]], registers[task.inputs[1]], node.weight, node.mask, result); }
+                    root_motion[task.result] = source_motion;
+                }
+
+                // additive and masked layers are on top of the source so only the layer is weighted
+                ring->scale_weights(target_events, node.weight);
+                events[task.result] = {source_events.begin, target_events.end};
+            }
+            break;
+        case AnimNodeType::ik:
+            if(evaluate_pose && node.ik != nullptr) { node.ik->solve(result); }
+            break;
+        }
+    }
+
+    if(list.tasks.empty())
+    {
+        if(evaluate_pose) { copy(reference_pose, output.pose); }
+        *output.events = {ring->write, ring->write};
+        *output.root_motion = RootMotionDelta{};
+    }
+    else
+    {
+        if(evaluate_pose)
+        {
+            // bones skipped by the lod stay in the reference pose
+            if(output.bone_count < output.pose->bone_count) { copy(reference_pose, output.pose); }
+            copy_prefix(registers[list.output], output.bone_count, output.pose);
+        }
+        *output.events = events[list.output];
+        *output.root_motion = root_motion[list.output];
+    }
+}
+
+void evaluate_characters(AnimCharacter* characters, std::size_t count, PoseArena* arenas, EventRing* rings, WorkerPool* workers, long long frame)
+{
+    workers->run(count, [&](std::size_t index)
+    {
+        AnimCharacter& character = characters[index];
+        if(character.graph_changed)
+        {
+            character.tasks = compile_graph(character.graph);
+            character.graph_changed = false;
+
+            // nodes start where they are, the first frame doesn't sample anything
+            character.sampled.resize(character.graph.nodes.size());
+            for(std::size_t node = 0; node < character.graph.nodes.size(); node += 1)
+            {
+                const float time = character.graph.nodes[node].time;
+                character.sampled[node] = {time, time};
+            }
+        }
+
+        const std::size_t thread_index = WorkerPool::get_thread_index();
+        PoseArena* arena = &arenas[thread_index];
+        character.output = arena->allocate_pose(character.bone_count);
+        character.event_ring = &rings[thread_index];
+
+        const int period = anim_lod_settings[static_cast<int>(character.lod)].period;
+        const std::size_t bone_count = character.lod_skeleton != nullptr ? character.lod_skeleton->bone_count[static_cast<int>(character.lod)] : character.bone_count;
+
+        // evaluate when it's our turn or if the history is too old to extrapolate from (the lod was just lowered)
+        // both poses need to be recent, a old first pose stretches the extrapolation over a gap the current period never had
+        const bool due = (frame + character.lod_phase) % period == 0;
+        const bool history_valid = character.history[0].data != nullptr && character.history_frame[0] >= 0
+            && frame - character.history_frame[1] <= period
+            && frame - character.history_frame[0] <= 2 * period;
+        if(period == 1 || due || history_valid == false)
+        {
+            execute(character.tasks, character.graph, *character.reference_pose, arena, character.event_ring, character.sampled.data(), {&character.output, bone_count, &character.events, &character.root_motion});
+
+            if(period > 1 && character.history[0].data != nullptr)
+            {
+                const PoseSoA oldest = character.history[0];
+                character.history[0] = character.history[1];
+                character.history[1] = oldest;
+                character.history_frame[0] = character.history_frame[1];
+                character.history_frame[1] = frame;
+                copy(character.output, &character.history[1]);
+            }
+        }
+        else
+        {
+            // events and root motion are cheap and can't be extrapolated so they are evaluated every frame
+            execute(character.tasks, character.graph, *character.reference_pose, arena, character.event_ring, character.sampled.data(), {nullptr, bone_count, &character.events, &character.root_motion});
+            const float t = static_cast<float>(frame - character.history_frame[0]) / static_cast<float>(character.history_frame[1] - character.history_frame[0]);
+            extrapolate_soa(character.history[0], character.history[1], t, &character.output);
+        }
+    });
+}
+
+std::size_t update_animation(AnimCharacter* characters, std::size_t count, PoseArena* arenas, EventRing* rings, WorkerPool* workers, long long frame)
+{
+    const std::size_t allocations_before = get_pose_allocation_count();
+    evaluate_characters(characters, count, arenas, rings, workers, frame);
+    solve_motion_warps(characters, count, workers);
+    const std::size_t allocations = get_pose_allocation_count() - allocations_before;
+    assert(allocations == 0 && "the animation update allocated, increase the arena or create the history when spawning");
+    return allocations;
+}
+
+template<typename TConsumer>
+void end_animation_frame(PoseArena* arenas, EventRing* rings, std::size_t count, TConsumer consumer)
+{
+    // "consumer can reason about what should be done, multiple foot events -> only triggger highest"
+    // so it gets everything at once instead of a callback per event
+    for(std::size_t i = 0; i < count; i += 1)
+    {
+        rings[i].consume(consumer);
+        arenas[i].reset();
+    }
+}
+
+
+// ===========================================================================
+// SKINNING PALETTE
+// local SoA pose -> character space -> deformation helpers -> * inverse bind pose = CompiledPose
+// done for every mesh instance so it's batched: the mesh hierarchy is flattened at load so the parent walk is a
+// single linear pass, copy_bones is resolved to a index per mesh bone and the matrix multiplies use simd
+
+/// procedural bones: twist/roll, pokes, look at, rbf...
+struct DeformationSolver
+{
+    enum class Kind { helper, rbf };
+
+    virtual ~DeformationSolver() = default;
+    virtual Kind get_kind() const = 0;
+
+    /** modify character space transforms in place, called after the hierarchy pass.
+     * The solver is loaded with mesh bone indices and is shared by every layout of the mesh so it's not changed,
+     * character_space is in palette order so look up each mesh bone in palette_from_mesh.
+    */
+    virtual void solve(mat4* character_space, std::size_t bone_count, const std::int16_t* palette_from_mesh) const = 0;
+};
+
+/// precomputed when the mesh is loaded
+struct SkinningLayout
+{
+    /// mesh bones sorted so parent[i] < i, everything but the final palette is in this order
+    std::vector<std::int16_t> parent;
+
+    /// the mesh bone of each sorted bone, the final palette is written in mesh order so the vertex weights don't change
+    std::vector<std::int16_t> mesh_bone;
+
+    /// the pose bone the mesh bone is copied from (copy_bones) or -1 for helper bones that use local_bind
+    std::vector<std::int16_t> source_bone;
+
+    /// the sorted index of each mesh bone, the inverse of mesh_bone
+    std::vector<std::int16_t> palette_from_mesh;
+
+    std::vector<mat4> local_bind;
+    std::vector<mat4> inverse_bind_pose;
+
+    /// from the mesh, solved with palette_from_mesh
+    std::vector<const DeformationSolver*> deformers;
+};
+
+SkinningLayout build_skinning_layout(const Mesh& mesh);
+
+struct SkinnedMeshInstance
+{
+    const SkinningLayout* layout;
+    const PoseSoA* pose; // AnimCharacter::output
+    AnimLod lod = AnimLod::full; // AnimCharacter::lod
+    CompiledPose palette; // written by build_palettes
+};
+
+/// one job per batch of instances, scratch memory and palettes are allocated from the thread's arena
+void build_palettes(SkinnedMeshInstance* instances, std::size_t count, PoseArena* arenas, WorkerPool* workers);
+
+
+// ---------------------------------------------------------------------------
+// matrix math
+
+/// reference and fallback
+inline void mul_scalar(const mat4& a, const mat4& b, mat4* r)
+{
+    for(int column = 0; column < 4; column += 1)
+    {
+        for(int row = 0; row < 4; row += 1)
+        {
+            float sum = 0.0f;
+            for(int k = 0; k < 4; k += 1)
+            {
+                sum += a.m[k * 4 + row] * b.m[column * 4 + k];
+            }
+            r->m[column * 4 + row] = sum;
+        }
+    }
+}
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+/// r = a * b, r may not alias a or b
+inline void mul(const mat4& a, const mat4& b, mat4* r)
+{
+    const __m128 a0 = _mm_load_ps(a.m + 0);
+    const __m128 a1 = _mm_load_ps(a.m + 4);
+    const __m128 a2 = _mm_load_ps(a.m + 8);
+    const __m128 a3 = _mm_load_ps(a.m + 12);
+    for(int column = 0; column < 4; column += 1)
+    {
+        const float* bc = b.m + column * 4;
+        __m128 c = _mm_mul_ps(a0, _mm_set1_ps(bc[0]));
+        c = _mm_add_ps(c, _mm_mul_ps(a1, _mm_set1_ps(bc[1])));
+        c = _mm_add_ps(c, _mm_mul_ps(a2, _mm_set1_ps(bc[2])));
+        c = _mm_add_ps(c, _mm_mul_ps(a3, _mm_set1_ps(bc[3])));
+        _mm_store_ps(r->m + column * 4, c);
+    }
+}
+#else
+inline void mul(const mat4& a, const mat4& b, mat4* r)
+{
+    mul_scalar(a, b, r);
+}
+#endif
+
+/// translation, rotation and scale from a SoA pose to a column major matrix
+inline void to_matrix(const PoseSoA& pose, std::size_t bone, mat4* r)
+{
+    const float x = pose.stream(PoseSoA::rx)[bone];
+    const float y = pose.stream(PoseSoA::ry)[bone];
+    const float z = pose.stream(PoseSoA::rz)[bone];
+    const float w = pose.stream(PoseSoA::rw)[bone];
+    const float sx = pose.stream(PoseSoA::sx)[bone];
+    const float sy = pose.stream(PoseSoA::sy)[bone];
+    const float sz = pose.stream(PoseSoA::sz)[bone];
+
+    r->m[0] = (1 - 2*(y*y + z*z)) * sx; r->m[1] = 2*(x*y + z*w) * sx;       r->m[2] = 2*(x*z - y*w) * sx;        r->m[3] = 0;
+    r->m[4] = 2*(x*y - z*w) * sy;       r->m[5] = (1 - 2*(x*x + z*z)) * sy; r->m[6] = 2*(y*z + x*w) * sy;        r->m[7] = 0;
+    r->m[8] = 2*(x*z + y*w) * sz;       r->m[9] = 2*(y*z - x*w) * sz;       r->m[10] = (1 - 2*(x*x + y*y)) * sz; r->m[11] = 0;
+    r->m[12] = pose.stream(PoseSoA::tx)[bone];
+    r->m[13] = pose.stream(PoseSoA::ty)[bone];
+    r->m[14] = pose.stream(PoseSoA::tz)[bone];
+    r->m[15] = 1;
+}
+
+
+// ---------------------------------------------------------------------------
+// palette
+
+SkinningLayout build_skinning_layout(const Mesh& mesh)
+{
+    SkinningLayout layout;
+    const std::size_t bone_count = mesh.bones.size();
+
+    // topological sort: place the unplaced ancestors of each bone before it,
+    // a mesh that is already parent first keeps its order
+    std::vector<std::int16_t> palette_from_mesh(bone_count, -1);
+    std::vector<int> chain;
+    for(std::size_t bone = 0; bone < bone_count; bone += 1)
+    {
+        for(int b = static_cast<int>(bone); b >= 0 && palette_from_mesh[b] < 0; b = mesh.bones[b].parent)
+        {
+            chain.push_back(b);
+            assert(chain.size() <= bone_count && "the mesh hierarchy has a cycle");
+        }
+        for(std::size_t i = chain.size(); i > 0; i -= 1)
+        {
+            palette_from_mesh[chain[i - 1]] = static_cast<std::int16_t>(layout.mesh_bone.size());
+            layout.mesh_bone.push_back(static_cast<std::int16_t>(chain[i - 1]));
+        }
+        chain.clear();
+    }
+
+    for(std::size_t sorted = 0; sorted < bone_count; sorted += 1)
+    {
+        const MeshBone& b = mesh.bones[layout.mesh_bone[sorted]];
+        layout.parent.push_back(b.parent < 0 ? std::int16_t{-1} : palette_from_mesh[b.parent]);
+        layout.source_bone.push_back(-1);
+        layout.local_bind.push_back(b.local_bind);
+        layout.inverse_bind_pose.push_back(b.inverse_bind_pose);
+    }
+
+    // copy_bones is (animation skeleton bone, mesh bone)
+    for(const auto& copy: mesh.copy_bones)
+    {
+        layout.source_bone[palette_from_mesh[copy.second]] = static_cast<std::int16_t>(copy.first);
+    }
+
+    for(const DeformationSolver* solver: mesh.deformers)
+    {
+        layout.deformers.push_back(solver);
+    }
+    layout.palette_from_mesh = std::move(palette_from_mesh);
+
+    return layout;
+}
+
+namespace
+{
+    void build_palette(SkinnedMeshInstance* instance, PoseArena* arena)
+    {
+        const SkinningLayout& layout = *instance->layout;
+        const std::size_t bone_count = layout.parent.size();
+
+        // scratch, freed with the rest of the arena at the end of the frame
+        CompiledPose character_space = arena->allocate_palette(bone_count);
+        instance->palette = arena->allocate_palette(bone_count);
+
+        // hierarchy: parent is always before child so one pass in order is enough
+        mat4 local;
+        for(std::size_t bone = 0; bone < bone_count; bone += 1)
+        {
+            const std::int16_t source = layout.source_bone[bone];
+            if(source >= 0) { to_matrix(*instance->pose, source, &local); }
+            else { local = layout.local_bind[bone]; }
+
+            const std::int16_t parent = layout.parent[bone];
+            if(parent < 0) { character_space.transforms[bone] = local; }
+            else { mul(character_space.transforms[parent], local, &character_space.transforms[bone]); }
+        }
+
+        const AnimLodSettings& lod = anim_lod_settings[static_cast<int>(instance->lod)];
+        for(const DeformationSolver* solver: layout.deformers)
+        {
+            const bool enabled = solver->get_kind() == DeformationSolver::Kind::rbf ? lod.rbf_solvers : lod.helper_solvers;
+            if(enabled == false) { continue; }
+            solver->solve(character_space.transforms, bone_count, layout.palette_from_mesh.data());
+        }
+
+        for(std::size_t bone = 0; bone < bone_count; bone += 1)
+        {
+            mul(character_space.transforms[bone], layout.inverse_bind_pose[bone], &instance->palette.transforms[layout.mesh_bone[bone]]);
+        }
+    }
+}
+
+void build_palettes(SkinnedMeshInstance* instances, std::size_t count, PoseArena* arenas, WorkerPool* workers)
+{
+    // a palette is ~50 bones, too little work for a job each
+    constexpr std::size_t batch_size = 16;
+    const std::size_t batch_count = (count + batch_size - 1) / batch_size;
+    workers->run(batch_count, [&](std::size_t batch)
+    {
+        PoseArena* arena = &arenas[WorkerPool::get_thread_index()];
+        const std::size_t end = (batch + 1) * batch_size < count ? (batch + 1) * batch_size : count;
+        for(std::size_t index = batch * batch_size; index < end; index += 1)
+        {
+            build_palette(&instances[index], arena);
+        }
+    });
+}
+
+// benchmark: 500 skinned meshes (multipart characters, ~60 mesh bones each)
+// per mesh scalar path (what the old CompiledPose code did) vs build_palette on the same thread, so only the simd multiply differs,
+// and then build_palettes to see what the jobs add on top
+void bench_skinning_palette(SkinnedMeshInstance* instances, PoseArena* arenas, WorkerPool* workers)
+{
+    constexpr std::size_t mesh_count = 500;
+
+    {
+        const double start = now_ms();
+        for(std::size_t index = 0; index < mesh_count; index += 1)
+        {
+            SkinnedMeshInstance& instance = instances[index];
+            const SkinningLayout& layout = *instance.layout;
+            const std::size_t bone_count = layout.parent.size();
+            CompiledPose character_space = arenas[0].allocate_palette(bone_count);
+            instance.palette = arenas[0].allocate_palette(bone_count);
+            mat4 local;
+            for(std::size_t bone = 0; bone < bone_count; bone += 1)
+            {
+                const std::int16_t source = layout.source_bone[bone];
+                if(source >= 0) { to_matrix(*instance.pose, source, &local); }
+                else { local = layout.local_bind[bone]; }
+                const std::int16_t parent = layout.parent[bone];
+                if(parent < 0) { character_space.transforms[bone] = local; }
+                else { mul_scalar(character_space.transforms[parent], local, &character_space.transforms[bone]); }
+            }
+            const AnimLodSettings& lod = anim_lod_settings[static_cast<int>(instance.lod)];
+            for(const DeformationSolver* solver: layout.deformers)
+            {
+                const bool enabled = solver->get_kind() == DeformationSolver::Kind::rbf ? lod.rbf_solvers : lod.helper_solvers;
+                if(enabled) { solver->solve(character_space.transforms, bone_count, layout.palette_from_mesh.data()); }
+            }
+            for(std::size_t bone = 0; bone < bone_count; bone += 1)
+            {
+                mul_scalar(character_space.transforms[bone], layout.inverse_bind_pose[bone], &instance.palette.transforms[layout.mesh_bone[bone]]);
+            }
+        }
+        print_result("scalar palette", now_ms() - start);
+    }
+    arenas[0].reset();
+
+    {
+        const double start = now_ms();
+        for(std::size_t index = 0; index < mesh_count; index += 1)
+        {
+            build_palette(&instances[index], &arenas[0]);
+        }
+        print_result("simd palette", now_ms() - start);
+    }
+    arenas[0].reset();
+
+    {
+        const double start = now_ms();
+        build_palettes(instances, mesh_count, arenas, workers);
+        print_result("threaded simd palette", now_ms() - start);
+    }
+    for(std::size_t i = 0; i < workers->get_worker_count() + 1; i += 1) { arenas[i].reset(); }
+}
+
+
+// ===========================================================================
+// SYNC BLENDING
+// walk and jog are blended by their sync tracks, not their local time, so the feet stay in phase
+// when the blend node is loaded the LCM table for the two clips is built: lcm(n, m) virtual segments where
+// each virtual segment maps to one real segment in each clip, a clip with fewer segments loops more than once
+// at runtime the node only has a phase in [0, 1) over the virtual cycle and looks up the local time for each clip
+
+struct SyncSegment
+{
+    float start; // local time in seconds
+    float end; // local time, might be larger than duration for the last segment, wrap when sampling
+};
+
+/// precomputed when loaded, never per frame
+struct SyncBlendTable
+{
+    std::size_t segment_count = 0;
+
+    /// segment_count per clip
+    std::vector<SyncSegment> segments[2];
+};
+
+/// there aren't many events in a cycle so the table stays small
+constexpr std::size_t max_sync_segments = 64;
+
+/// the first event in b that has the same id as the first event in a is aligned with it, otherwise they start together
+SyncBlendTable build_sync_table(const CompressedAnimation& a, const CompressedAnimation& b);
+
+/** Drives two sample nodes and a blend node in a AnimGraph.
+ * Updated before the task list is executed, it only changes node parameters so no recompile is needed
+*/
+struct SyncBlendNode
+{
+    const CompressedAnimation* clips[2];
+    const SyncBlendTable* table;
+
+    int sample_nodes[2]; // in the graph
+    int blend_node;
+
+    float weight = 0.0f; // 0 = clips[0], 1 = clips[1], set by gameplay
+    float phase = 0.0f; // [0, 1) over the whole virtual cycle
+};
+
+/// sets the warped local time of the sample nodes, events are sampled from where the last evaluate ended
+void update_sync_blend(SyncBlendNode* node, AnimGraph* graph, float dt);
+
+
+// ---------------------------------------------------------------------------
+// sync table
+
+namespace
+{
+    std::size_t gcd(std::size_t a, std::size_t b)
+    {
+        while(b != 0)
+        {
+            const std::size_t t = a % b;
+            a = b;
+            b = t;
+        }
+        return a;
+    }
+
+    std::size_t lcm(std::size_t a, std::size_t b)
+    {
+        return a / gcd(a, b) * b;
+    }
+
+    /// default track with one event if the clip doesn't have any markup
+    std::size_t get_event_count(const SyncTrack& track)
+    {
+        return track.events.empty() ? 1 : track.events.size();
+    }
+
+    SyncSegment get_segment(const CompressedAnimation& clip, std::size_t index)
+    {
+        const float duration = clip.get_duration();
+        const auto& events = clip.sync_track.events;
+        if(events.empty()) { return {0.0f, duration}; }
+
+        const std::size_t next = index + 1;
+        SyncSegment segment;
+        segment.start = events[index].start;
+        segment.end = next < events.size() ? events[next].start : events[0].start + duration;
+        return segment;
+    }
+
+    float wrap_time(float time, float duration)
+    {
+        if(duration <= 0.0f) { return 0.0f; }
+        while(time >= duration) { time -= duration; }
+        return time;
+    }
+}
+
+SyncBlendTable build_sync_table(const CompressedAnimation& a, const CompressedAnimation& b)
+{
+    const std::size_t a_count = get_event_count(a.sync_track);
+    const std::size_t b_count = get_event_count(b.sync_track);
+
+    // "start from [track] in src and sync with [another track] in dst"
+    std::size_t b_offset = 0;
+    if(a.sync_track.events.empty() == false)
+    {
+        for(std::size_t index = 0; index < b.sync_track.events.size(); index += 1)
+        {
+            if(b.sync_track.events[index].id == a.sync_track.events[0].id)
+            {
+                b_offset = index;
+                break;
+            }
+        }
+    }
+
+    SyncBlendTable table;
+    table.segment_count = lcm(a_count, b_count);
+    assert(table.segment_count <= max_sync_segments);
+
+    for(std::size_t segment = 0; segment < table.segment_count; segment += 1)
+    {
+        table.segments[0].push_back(get_segment(a, segment % a_count));
+        table.segments[1].push_back(get_segment(b, (segment + b_offset) % b_count));
+    }
+
+    return table;
+}
+
+
+// ---------------------------------------------------------------------------
+// sync blend node
+
+void update_sync_blend(SyncBlendNode* node, AnimGraph* graph, float dt)
+{
+    const SyncBlendTable& table = *node->table;
+    const float durations[2] = {node->clips[0]->get_duration(), node->clips[1]->get_duration()};
+
+    // the length of the virtual cycle is blended, a clip that loops twice in the cycle counts twice
+    const float loops_per_cycle[2] =
+    {
+        static_cast<float>(table.segment_count) / get_event_count(node->clips[0]->sync_track),
+        static_cast<float>(table.segment_count) / get_event_count(node->clips[1]->sync_track)
+    };
+    const float cycle[2] = {durations[0] * loops_per_cycle[0], durations[1] * loops_per_cycle[1]};
+    const float cycle_duration = cycle[0] + (cycle[1] - cycle[0]) * node->weight;
+
+    // the sample task gets a single range per clip so a frame can't be longer than one loop of a clip,
+    // the events of the loops in between would be skipped. On a hitch the rest of the time is dropped instead
+    const float most_loops = loops_per_cycle[0] > loops_per_cycle[1] ? loops_per_cycle[0] : loops_per_cycle[1];
+    const float max_advance = 0.99f / most_loops;
+
+    if(cycle_duration > 0.0f)
+    {
+        const float advance = dt / cycle_duration;
+        node->phase += advance < max_advance ? advance : max_advance;
+        if(node->phase >= 1.0f) { node->phase -= 1.0f; }
+    }
+
+    // phase -> segment + percent -> local time in each clip
+    auto get_local_time = [&](float phase, int clip)
+    {
+        const float virtual_time = phase * table.segment_count;
+        std::size_t segment_index = static_cast<std::size_t>(virtual_time);
+        if(segment_index >= table.segment_count) { segment_index = table.segment_count - 1; }
+        const float percent = virtual_time - segment_index;
+        const SyncSegment& segment = table.segments[clip][segment_index];
+        return wrap_time(segment.start + (segment.end - segment.start) * percent, durations[clip]);
+    };
+
+    // events are sampled in warped local time from the last evaluate to time, the sample task splits a wrap in two
+    for(int clip = 0; clip < 2; clip += 1)
+    {
+        graph->nodes[node->sample_nodes[clip]].time = get_local_time(node->phase, clip);
+    }
+
+    graph->nodes[node->blend_node].weight = node->weight;
+}
+
+
+// ===========================================================================
+// ROOT MOTION
+// extracted at import and stored uncompressed next to the compressed pose tracks
+// sampled as a delta between the previous and current time of a sample node and blended through the task list
+// like the pose: interpolative blends use vector slerp, additive layers add a weighted delta on top
+
+// tdlr of the warp: the window is a event in the clip, each frame the remaining motion in the clip is compared
+// with where the target is and the error is spread over the rest of the window
+
+/// a warp window in the clip is marked with this event, the event duration is the window
+constexpr std::uint32_t motion_warp_event_type = 0x6d776172; // 'mwar'
+
+struct MotionWarp
+{
+    /// the sample node that plays the clip with the warp window, it's time is used to find where we are in the window
+    int sample_node;
+    float window_start;
+    float window_end;
+
+    // set by gameplay each frame, can change if the target is moving
+    vec3 position; // where the character is in world space
+    quat rotation;
+    vec3 target_position;
+    quat target_rotation;
+
+    /// "only allow translation of xy and then only allow translation of z", 0 or 1 per axis
+    vec3 translation_mask = {1.0f, 1.0f, 1.0f};
+    bool warp_rotation = true;
+};
+
+/// finds the warp window event in the clip, false if there is none
+bool begin_motion_warp(const AnimCharacter& character, int sample_node, MotionWarp* warp);
+
+
+// ---------------------------------------------------------------------------
+// extraction
+
+void extract_root_motion(Animation* source, int root_bone, RootMotionTrack* result)
+{
+    const int frame_count = get_frame_count(*source);
+    AnimationTrack& track = source->tracks[root_bone];
+    for(int frame = 0; frame < frame_count; frame += 1)
+    {
+        const Transform root = track.get_transform(source->data, frame, 0.0f);
+        result->translation.push_back(root.translation);
+        result->rotation.push_back(root.rotation);
+    }
+
+    // "when extracted, root motion is extracted and root is always at (0, 0, 0)"
+    set_constant(source, &track, Transform{{0.0f, 0.0f, 0.0f}, identity_quat, {1.0f, 1.0f, 1.0f}});
+}
+
+
+// ---------------------------------------------------------------------------
+// sampling and blending
+
+namespace
+{
+    void sample_root(const CompressedAnimation& clip, float time, vec3* translation, quat* rotation)
+    {
+        const RootMotionTrack& track = clip.root_motion;
+        const int last = static_cast<int>(track.translation.size()) - 1;
+        const float frame = time * clip.fps;
+        int index = static_cast<int>(frame);
+        float offset = frame - index;
+        if(index >= last) { index = last; offset = 0.0f; }
+        const int next = index < last ? index + 1 : index;
+        *translation = lerp(track.translation[index], track.translation[next], offset);
+        *rotation = nlerp(track.rotation[index], track.rotation[next], offset);
+    }
+
+    /// root motion from -> to, expressed in the root at from
+    RootMotionDelta get_root_delta(const CompressedAnimation& clip, float from, float to)
+    {
+        vec3 from_translation; quat from_rotation;
+        vec3 to_translation; quat to_rotation;
+        sample_root(clip, from, &from_translation, &from_rotation);
+        sample_root(clip, to, &to_translation, &to_rotation);
+
+        const quat inverse_from = inverse(from_rotation);
+        RootMotionDelta delta;
+        delta.translation = rotate(inverse_from, to_translation - from_translation);
+        delta.rotation = inverse_from * to_rotation;
+        return delta;
+    }
+
+    /// first then second, second is relative to where first ended
+    RootMotionDelta concat(const RootMotionDelta& first, const RootMotionDelta& second)
+    {
+        RootMotionDelta delta;
+        delta.translation = first.translation + rotate(first.rotation, second.translation);
+        delta.rotation = first.rotation * second.rotation;
+        return delta;
+    }
+}
+
+RootMotionDelta sample_root_motion(const CompressedAnimation& clip, TimeRange range)
+{
+    if(clip.root_motion.translation.empty()) { return RootMotionDelta{}; }
+
+    if(range.to >= range.from)
+    {
+        return get_root_delta(clip, range.from, range.to);
+    }
+
+    // looped: end of the clip then the start
+    return concat(get_root_delta(clip, range.from, clip.get_duration()), get_root_delta(clip, 0.0f, range.to));
+}
+
+RootMotionDelta blend_root_motion(const RootMotionDelta& from, const RootMotionDelta& to, float weight)
+{
+    // deltas, so lerp would shorten the motion when blending between two directions
+    RootMotionDelta delta;
+    delta.translation = vector_slerp(from.translation, to.translation, weight);
+    delta.rotation = slerp(from.rotation, to.rotation, weight);
+    return delta;
+}
+
+RootMotionDelta add_root_motion(const RootMotionDelta& base, const RootMotionDelta& layer, float weight)
+{
+    RootMotionDelta delta;
+    delta.translation = base.translation + layer.translation * weight;
+    delta.rotation = base.rotation * slerp(identity_quat, layer.rotation, weight);
+    return delta;
+}
+
+
+// ---------------------------------------------------------------------------
+// motion warping
+
+bool begin_motion_warp(const AnimCharacter& character, int sample_node, MotionWarp* warp)
+{
+    const AnimNode& node = character.graph.nodes[sample_node];
+    assert(node.type == AnimNodeType::sample && node.clip != nullptr);
+
+    for(const ClipEvent& e: node.clip->events)
+    {
+        if(e.type == motion_warp_event_type)
+        {
+            warp->sample_node = sample_node;
+            warp->window_start = e.start;
+            warp->window_end = e.start + e.duration;
+            return true;
+        }
+    }
+    return false;
+}
+
+namespace
+{
+    void solve_motion_warp(AnimCharacter* character)
+    {
+        const MotionWarp& warp = *character->warp;
+        const CompressedAnimation& clip = *character->graph.nodes[warp.sample_node].clip;
+        const TimeRange& range = character->sampled[warp.sample_node];
+
+        // only inside the window and only if the clip didn't loop this frame
+        if(range.to < range.from) { return; }
+        if(range.to <= warp.window_start || range.from >= warp.window_end) { return; }
+
+        RootMotionDelta& delta = character->root_motion;
+
+        // where the character ends up after this frame and the rest of the window as animated
+        const vec3 position = warp.position + rotate(warp.rotation, delta.translation);
+        const quat rotation = warp.rotation * delta.rotation;
+        const float now = range.to < warp.window_end ? range.to : warp.window_end;
+        const RootMotionDelta remaining = get_root_delta(clip, now, warp.window_end);
+        const vec3 predicted_position = position + rotate(rotation, remaining.translation);
+        const quat predicted_rotation = rotation * remaining.rotation;
+
+        // spread the error over what is left of the window, this frame covers this much of it
+        const float window_from = range.from > warp.window_start ? range.from : warp.window_start;
+        const float window_left = warp.window_end - window_from;
+        const float fraction = window_left > 0.0f ? (now - window_from) / window_left : 1.0f;
+
+        const vec3 error = warp.target_position - predicted_position;
+        const vec3 masked_error = {error.x * warp.translation_mask.x, error.y * warp.translation_mask.y, error.z * warp.translation_mask.z};
+        delta.translation = delta.translation + rotate(inverse(warp.rotation), masked_error * fraction);
+
+        if(warp.warp_rotation)
+        {
+            const quat rotation_error = inverse(predicted_rotation) * warp.target_rotation;
+            delta.rotation = delta.rotation * slerp(identity_quat, rotation_error, fraction);
+        }
+    }
+}
+
+void solve_motion_warps(AnimCharacter* characters, std::size_t count, WorkerPool* workers)
+{
+    // cheap per character so batches, most characters aren't warping
+    constexpr std::size_t batch_size = 64;
+    const std::size_t batch_count = (count + batch_size - 1) / batch_size;
+    workers->run(batch_count, [&](std::size_t batch)
+    {
+        const std::size_t end = (batch + 1) * batch_size < count ? (batch + 1) * batch_size : count;
+        for(std::size_t index = batch * batch_size; index < end; index += 1)
+        {
+            if(characters[index].warp != nullptr)
+            {
+                solve_motion_warp(&characters[index]);
+            }
+        }
+    });
+}
+
+
+// ===========================================================================
+// ANIMATION LOD
+
+AnimLodSkeleton build_lod_skeleton(const BoneMask* lod_masks)
+{
+    AnimLodSkeleton skeleton;
+    for(std::size_t lod = 0; lod < anim_lod_count; lod += 1)
+    {
+        const auto& mask = lod_masks[lod].mask;
+        std::size_t count = 0;
+        while(count < mask.size() && mask[count] > 0.0f) { count += 1; }
+
+        // the importer sorts the skeleton so this holds, a bone after the prefix would be silently dropped otherwise
+        for(std::size_t bone = count; bone < mask.size(); bone += 1) { assert(mask[bone] <= 0.0f); }
+        assert(lod == 0 || count <= skeleton.bone_count[lod - 1]);
+
+        skeleton.bone_count[lod] = count;
+    }
+    return skeleton;
+}
+
+void extrapolate_soa(const PoseSoA& previous, const PoseSoA& last, float t, PoseSoA* result)
+{
+    assert(previous.bone_count == last.bone_count && last.bone_count == result->bone_count);
+
+    // far characters move slowly on screen but a pose that keeps going for too long looks broken
+    const simd_float weight = simd_set(t < 2.0f ? t : 2.0f);
+    for(std::size_t bone = 0; bone < result->bone_count; bone += simd_width)
+    {
+        for(auto s: {PoseSoA::tx, PoseSoA::ty, PoseSoA::tz, PoseSoA::sx, PoseSoA::sy, PoseSoA::sz})
+        {
+            simd_store(result->stream(s) + bone, BlendSoA_Interpolative::component(simd_load(previous.stream(s) + bone), simd_load(last.stream(s) + bone), weight));
+        }
+
+        // the slerp approximation is only fitted for [0, 1], nlerp extrapolates fine for short steps
+        store_rotation(result, bone, nlerp(load_rotation(previous, bone), load_rotation(last, bone), weight));
+    }
+}
+
+void create_lod_history(AnimCharacter* character)
+{
+    for(int i = 0; i < 2; i += 1)
+    {
+        character->history[i].bone_count = character->bone_count;
+        character->history[i].data = allocate_aligned(PoseSoA::stream_count * character->bone_count, 32);
+        character->history_frame[i] = -1000;
+    }
+}
+
+void destroy_lod_history(AnimCharacter* character)
+{
+    for(int i = 0; i < 2; i += 1)
+    {
+        free_aligned(character->history[i].data);
+        character->history[i].data = nullptr;
+    }
+}
+
+void AnimLodScheduler::schedule(AnimCharacter* characters, std::size_t count, const vec3& camera)
+{
+    order.resize(count);
+    distance_squared.resize(count);
+
+    // lod from distance
+    for(std::size_t index = 0; index < count; index += 1)
+    {
+        const vec3 d = characters[index].position - camera;
+        const float dd = d.x*d.x + d.y*d.y + d.z*d.z;
+        distance_squared[index] = dd;
+        order[index] = static_cast<std::uint32_t>(index);
+
+        int lod = 0;
+        while(lod < static_cast<int>(anim_lod_count) - 1 && dd >= distances[lod] * distances[lod]) { lod += 1; }
+        characters[index].lod = static_cast<AnimLod>(lod);
+    }
+
+    auto get_bones_per_frame = [&](const AnimCharacter& character, AnimLod lod)
+    {
+        const std::size_t bones = character.lod_skeleton != nullptr ? character.lod_skeleton->bone_count[static_cast<int>(lod)] : character.bone_count;
+        return bones / anim_lod_settings[static_cast<int>(lod)].period;
+    };
+
+    scheduled_bones = 0;
+    for(std::size_t index = 0; index < count; index += 1)
+    {
+        scheduled_bones += get_bones_per_frame(characters[index], characters[index].lod);
+    }
+
+    // over budget: lower the lod of the furthest characters first, one step at a time
+    if(scheduled_bones > bone_budget)
+    {
+        sort(order.begin(), order.end(), [&](std::uint32_t lhs, std::uint32_t rhs) { return distance_squared[lhs] > distance_squared[rhs]; });
+        for(int pass = 0; pass < static_cast<int>(anim_lod_count) - 1 && scheduled_bones > bone_budget; pass += 1)
+        {
+            for(std::size_t i = 0; i < count && scheduled_bones > bone_budget; i += 1)
+            {
+                AnimCharacter& character = characters[order[i]];
+                if(character.lod == AnimLod::far) { continue; }
+                const AnimLod lower = static_cast<AnimLod>(static_cast<int>(character.lod) + 1);
+                scheduled_bones -= get_bones_per_frame(character, character.lod);
+                scheduled_bones += get_bones_per_frame(character, lower);
+                character.lod = lower;
+            }
+        }
+        // todo(Gustav): if still over budget the full rate characters closest to the camera are left as is, let it go over
+    }
+
+    // spread each lod over its period so the cost is the same every frame
+    int next_phase[anim_lod_count] = {0, 0, 0, 0};
+    for(std::size_t index = 0; index < count; index += 1)
+    {
+        AnimCharacter& character = characters[index];
+        const int lod = static_cast<int>(character.lod);
+        character.lod_phase = next_phase[lod];
+        next_phase[lod] = (next_phase[lod] + 1) % anim_lod_settings[lod].period;
+    }
+}
@@ -21,6 +21,30 @@ Dictionary:
 #include <string_view>
 #include <unordered_map>
 #include <memory>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstdint>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <new>
+#include <tuple>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <cstring>
+#include <type_traits>
+#include <random>
+#include <limits>
+#include <utility>
+
+/// Compile time switch for the profiler, when 0 the PROFILE_ macros expand to nothing
+#ifndef ENTITY_PROFILER
+#define ENTITY_PROFILER 0
+#endif
 
 
 namespace core
@@ -28,14 +52,375 @@ namespace core
     /// external type 
     struct Guid {};
 
-    /// external type
-    struct mat4f {};
+    /// external type, minimal version so transforms can be calculated
+    struct vec3f { float x = 0.0f; float y = 0.0f; float z = 0.0f; };
+
+    /// external type, minimal column major version so transforms can be calculated
+    struct alignas(16) mat4f
+    {
+        float m[16] = {1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1};
+    };
+
+    mat4f operator*(const mat4f& lhs, const mat4f& rhs);
+    vec3f transform_point(const mat4f& m, const vec3f& p);
+    vec3f transform_vector(const mat4f& m, const vec3f& v);
 
     /// external type
-    struct Obb {};
+    struct Obb
+    {
+        vec3f center;
+
+        /// the box axes scaled by the half extents
+        std::array<vec3f, 3> half_axes = {vec3f{1,0,0}, vec3f{0,1,0}, vec3f{0,0,1}};
+    };
+
+    Obb transform(const mat4f& m, const Obb& box);
+
+    /// axis aligned box, used for broadphase queries
+    struct Aabb
+    {
+        vec3f min;
+        vec3f max;
+    };
+
+    /// the smallest axis aligned box that contains the obb
+    Aabb to_aabb(const Obb& box);
+    Aabb merge(const Aabb& lhs, const Aabb& rhs);
+    Aabb expand(const Aabb& box, float margin);
+    float surface_area(const Aabb& box);
+    bool contains(const Aabb& outer, const Aabb& inner);
+
+    /// points where dot(normal, p) + distance >= 0 are in front of the plane
+    struct Plane
+    {
+        vec3f normal = {0, 0, 1};
+        float distance = 0.0f;
+    };
+
+    /// the planes point inwards
+    struct Frustum
+    {
+        std::array<Plane, 6> planes;
+    };
+
+    /// extract the planes from a view projection matrix (opengl clip space)
+    Frustum make_frustum(const mat4f& view_projection);
+
+    struct Sphere
+    {
+        vec3f center;
+        float radius = 0.0f;
+    };
+
+    /// direction is normalized, hits are within length units from the origin
+    struct Ray
+    {
+        vec3f origin;
+        vec3f direction = {0, 0, 1};
+        float length = 0.0f;
+    };
+
+    enum class Containment { outside, intersecting, inside };
+
+    Containment classify(const Frustum& frustum, const Aabb& box);
+    bool intersects(const Sphere& sphere, const Aabb& box);
+
+    /// the inverse direction is the same for all boxes so the caller calculates it once
+    bool intersects(const Ray& ray, const vec3f& inverse_direction, const Aabb& box);
+
+    /// 64 bit FNV-1a, constexpr so literals are hashed at compile time
+    constexpr std::uint64_t hash_fnv1a(std::string_view str)
+    {
+        std::uint64_t hash = 14695981039346656037ull;
+        for(const char c: str)
+        {
+            hash ^= static_cast<std::uint8_t>(c);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    /** A string view with a precomputed hash.
+     * Equality only compares the hash, collisions are checked when adding to a HashTable in debug builds.
+    */
+    struct HashedStringView
+    {
+        constexpr HashedStringView() : HashedStringView(std::string_view{}) {}
+        constexpr HashedStringView(const char* str) : HashedStringView(std::string_view{str}) {}
+        constexpr HashedStringView(std::string_view str) : string(str), hash(hash_fnv1a(str)) {}
+
+        std::string_view string;
+        std::uint64_t hash;
+
+        constexpr bool operator==(const HashedStringView& rhs) const { return hash == rhs.hash; }
+        constexpr bool operator!=(const HashedStringView& rhs) const { return hash != rhs.hash; }
+    };
+
+    namespace literals
+    {
+        /// "name"_hs, use in a constexpr context to make sure it's hashed at compile time
+        constexpr HashedStringView operator""_hs(const char* str, std::size_t length)
+        {
+            return HashedStringView{std::string_view{str, length}};
+        }
+    }
+
+    /** Flat open addressing hash table with linear probing, keyed on the precomputed HashedStringView hash.
+     * Can't remove, the factories only add.
+    */
+    template<typename T>
+    struct HashTable
+    {
+        void add(HashedStringView key, T value);
+
+        /// null if not found
+        const T* find(HashedStringView key) const;
+
+    private:
+        struct Entry
+        {
+            std::uint64_t hash;
+            std::string_view name; // for collision checks
+            T value;
+            bool used = false;
+        };
+
+        void grow();
+
+        std::vector<Entry> entries;
+        std::size_t used_count = 0;
+    };
+
+    template<typename T>
+    void HashTable<T>::add(HashedStringView key, T value)
+    {
+        // keep the load factor below 0.5 so probing stays short
+        if((used_count + 1) * 2 > entries.size())
+        {
+            grow();
+        }
+
+        const std::size_t mask = entries.size() - 1;
+        for(std::size_t index = key.hash & mask; ; index = (index + 1) & mask)
+        {
+            Entry& e = entries[index];
+            if(e.used == false)
+            {
+                e = {key.hash, key.string, std::move(value), true};
+                used_count += 1;
+                return;
+            }
+            if(e.hash == key.hash)
+            {
+                assert(e.name == key.string && "hash collision between two different names");
+                e.value = std::move(value);
+                return;
+            }
+        }
+    }
+
+    template<typename T>
+    const T* HashTable<T>::find(HashedStringView key) const
+    {
+        if(entries.empty()) { return nullptr; }
+
+        const std::size_t mask = entries.size() - 1;
+        for(std::size_t index = key.hash & mask; ; index = (index + 1) & mask)
+        {
+            const Entry& e = entries[index];
+            if(e.used == false) { return nullptr; }
+            if(e.hash == key.hash) { return &e.value; }
+        }
+    }
+
+    template<typename T>
+    void HashTable<T>::grow()
+    {
+        std::vector<Entry> old = std::move(entries);
+        entries = std::vector<Entry>(old.empty() ? 16 : old.size() * 2);
+        used_count = 0;
+        for(auto& e: old)
+        {
+            if(e.used == false) { continue; }
+            add(HashedStringView{e.name}, std::move(e.value));
+        }
+    }
+
+    mat4f operator*(const mat4f& lhs, const mat4f& rhs)
+    {
+        // straight loops without branches so the compiler can vectorize the rows
+        mat4f r;
+        for(int column=0; column<4; column+=1)
+        {
+            for(int row=0; row<4; row+=1)
+            {
+                r.m[column*4 + row] =
+                    lhs.m[0*4 + row] * rhs.m[column*4 + 0] +
+                    lhs.m[1*4 + row] * rhs.m[column*4 + 1] +
+                    lhs.m[2*4 + row] * rhs.m[column*4 + 2] +
+                    lhs.m[3*4 + row] * rhs.m[column*4 + 3];
+            }
+        }
+        return r;
+    }
+
+    vec3f transform_point(const mat4f& m, const vec3f& p)
+    {
+        return
+        {
+            m.m[0]*p.x + m.m[4]*p.y + m.m[ 8]*p.z + m.m[12],
+            m.m[1]*p.x + m.m[5]*p.y + m.m[ 9]*p.z + m.m[13],
+            m.m[2]*p.x + m.m[6]*p.y + m.m[10]*p.z + m.m[14]
+        };
+    }
+
+    vec3f transform_vector(const mat4f& m, const vec3f& v)
+    {
+        return
+        {
+            m.m[0]*v.x + m.m[4]*v.y + m.m[ 8]*v.z,
+            m.m[1]*v.x + m.m[5]*v.y + m.m[ 9]*v.z,
+            m.m[2]*v.x + m.m[6]*v.y + m.m[10]*v.z
+        };
+    }
+
+    Obb transform(const mat4f& m, const Obb& box)
+    {
+        return
+        {
+            transform_point(m, box.center),
+            {transform_vector(m, box.half_axes[0]), transform_vector(m, box.half_axes[1]), transform_vector(m, box.half_axes[2])}
+        };
+    }
+
+    Aabb to_aabb(const Obb& box)
+    {
+        const vec3f extent =
+        {
+            std::abs(box.half_axes[0].x) + std::abs(box.half_axes[1].x) + std::abs(box.half_axes[2].x),
+            std::abs(box.half_axes[0].y) + std::abs(box.half_axes[1].y) + std::abs(box.half_axes[2].y),
+            std::abs(box.half_axes[0].z) + std::abs(box.half_axes[1].z) + std::abs(box.half_axes[2].z)
+        };
+        return
+        {
+            {box.center.x - extent.x, box.center.y - extent.y, box.center.z - extent.z},
+            {box.center.x + extent.x, box.center.y + extent.y, box.center.z + extent.z}
+        };
+    }
+
+    Aabb merge(const Aabb& lhs, const Aabb& rhs)
+    {
+        return
+        {
+            {std::min(lhs.min.x, rhs.min.x), std::min(lhs.min.y, rhs.min.y), std::min(lhs.min.z, rhs.min.z)},
+            {std::max(lhs.max.x, rhs.max.x), std::max(lhs.max.y, rhs.max.y), std::max(lhs.max.z, rhs.max.z)}
+        };
+    }
+
+    Aabb expand(const Aabb& box, float margin)
+    {
+        return
+        {
+            {box.min.x - margin, box.min.y - margin, box.min.z - margin},
+            {box.max.x + margin, box.max.y + margin, box.max.z + margin}
+        };
+    }
+
+    float surface_area(const Aabb& box)
+    {
+        const float x = box.max.x - box.min.x;
+        const float y = box.max.y - box.min.y;
+        const float z = box.max.z - box.min.z;
+        return 2.0f * (x*y + y*z + z*x);
+    }
+
+    bool contains(const Aabb& outer, const Aabb& inner)
+    {
+        return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.min.z <= inner.min.z
+            && inner.max.x <= outer.max.x && inner.max.y <= outer.max.y && inner.max.z <= outer.max.z;
+    }
+
+    Frustum make_frustum(const mat4f& view_projection)
+    {
+        // Gribb & Hartmann: the planes are sums and differences of the last row and the other rows
+        const auto row = [&view_projection](int r) -> std::array<float, 4>
+        {
+            return {view_projection.m[0*4 + r], view_projection.m[1*4 + r], view_projection.m[2*4 + r], view_projection.m[3*4 + r]};
+        };
+        const auto make_plane = [](const std::array<float, 4>& w, const std::array<float, 4>& r, float sign) -> Plane
+        {
+            const float x = w[0] + sign*r[0];
+            const float y = w[1] + sign*r[1];
+            const float z = w[2] + sign*r[2];
+            const float d = w[3] + sign*r[3];
+            const float inverse_length = 1.0f / std::sqrt(x*x + y*y + z*z);
+            return {{x*inverse_length, y*inverse_length, z*inverse_length}, d*inverse_length};
+        };
+
+        const auto w = row(3);
+        Frustum frustum;
+        for(int axis=0; axis<3; axis+=1)
+        {
+            frustum.planes[static_cast<std::size_t>(axis*2 + 0)] = make_plane(w, row(axis), 1.0f);
+            frustum.planes[static_cast<std::size_t>(axis*2 + 1)] = make_plane(w, row(axis), -1.0f);
+        }
+        return frustum;
+    }
+
+    Containment classify(const Frustum& frustum, const Aabb& box)
+    {
+        const vec3f center = {(box.min.x + box.max.x) * 0.5f, (box.min.y + box.max.y) * 0.5f, (box.min.z + box.max.z) * 0.5f};
+        const vec3f extent = {(box.max.x - box.min.x) * 0.5f, (box.max.y - box.min.y) * 0.5f, (box.max.z - box.min.z) * 0.5f};
+
+        Containment result = Containment::inside;
+        for(const Plane& plane: frustum.planes)
+        {
+            const float distance = plane.normal.x*center.x + plane.normal.y*center.y + plane.normal.z*center.z + plane.distance;
+            const float radius = std::abs(plane.normal.x)*extent.x + std::abs(plane.normal.y)*extent.y + std::abs(plane.normal.z)*extent.z;
+            if(distance < -radius) { return Containment::outside; }
+            if(distance < radius) { result = Containment::intersecting; }
+        }
+        return result;
+    }
+
+    bool intersects(const Sphere& sphere, const Aabb& box)
+    {
+        const float x = std::clamp(sphere.center.x, box.min.x, box.max.x) - sphere.center.x;
+        const float y = std::clamp(sphere.center.y, box.min.y, box.max.y) - sphere.center.y;
+        const float z = std::clamp(sphere.center.z, box.min.z, box.max.z) - sphere.center.z;
+        return x*x + y*y + z*z <= sphere.radius * sphere.radius;
+    }
+
+    bool intersects(const Ray& ray, const vec3f& inverse_direction, const Aabb& box)
+    {
+        // slab test
+        const float x1 = (box.min.x - ray.origin.x) * inverse_direction.x;
+        const float x2 = (box.max.x - ray.origin.x) * inverse_direction.x;
+        const float y1 = (box.min.y - ray.origin.y) * inverse_direction.y;
+        const float y2 = (box.max.y - ray.origin.y) * inverse_direction.y;
+        const float z1 = (box.min.z - ray.origin.z) * inverse_direction.z;
+        const float z2 = (box.max.z - ray.origin.z) * inverse_direction.z;
+
+        const float enter = std::max({0.0f, std::min(x1, x2), std::min(y1, y2), std::min(z1, z2)});
+        const float exit = std::min({ray.length, std::max(x1, x2), std::max(y1, y2), std::max(z1, z2)});
+        return enter <= exit;
+    }
+
+    /// O(1) erase that doesn't keep the order, the last element is moved to index
+    template<typename T>
+    void swap_back_and_erase(std::vector<T>* asrc, std::size_t index)
+    {
+        assert(asrc);
+        std::vector<T>& src = *asrc;
+        assert(index < src.size());
 
-    // struct HashedStringView {};
-    using HashedStringView = std::string_view;
+        const auto last_index = src.size()-1;
+        if(index != last_index)
+        {
+            std::swap(src[index], src[last_index]);
+        }
+        src.pop_back();
+    }
 
     template<typename T, typename F>
     void update_and_erase(std::vector<T>* asrc, F&& update)
@@ -64,853 +449,5819 @@ namespace core
             }
         }
     }
-}
 
-namespace entity
-{
+    /** A fixed set of worker threads that run jobs in parallel.
+     * The calling thread helps out, so a pool with 0 workers runs everything on the caller.
+    */
+    struct WorkerPool
+    {
+        explicit WorkerPool(std::size_t worker_count);
+        ~WorkerPool();
 
+        WorkerPool(const WorkerPool&) = delete;
+        void operator=(const WorkerPool&) = delete;
 
+        std::size_t get_worker_count() const;
 
+        /// 0 for the thread that called run(), 1 to worker count for the workers
+        static std::size_t get_thread_index();
 
+        /// call job(index) for each index in [0, count), blocks until all jobs are done
+        void run(std::size_t count, const std::function<void (std::size_t)>& job);
 
-    ///////////////////////////////////////////////////////////////////////////////////////////////
-    // forward declare
+    private:
+        void worker_main(std::size_t thread_index);
+        void run_jobs(const std::function<void (std::size_t)>& job, std::size_t count);
 
-    struct EntitySystemWithPrio;
-    struct EntitySystemUpdateStageList;
-    struct EntitySystemUpdate;
+        std::vector<std::thread> workers;
 
-    struct WorldSystemWithPrio;
-    struct WorldSystemUpdateStageList;
-    struct WorldSystemUpdate;
+        std::mutex mutex;
+        std::condition_variable work_available;
+        std::condition_variable work_done;
 
-    struct Entity;
-    struct Component;
-        struct ComponentType;
-        struct ComponentFactory;
-    struct SpatialComponent;
-    struct RequestedComponents;
-    struct EntitySystem;
-        struct EntitySystemType;
-        struct EntitySystemFactory;
-    struct WorldSystem;
-        struct WorldSystemType;
-        struct WorldSystemFactory;
-    struct World;
+        const std::function<void (std::size_t)>* current_job = nullptr;
+        std::size_t job_count = 0;
+        std::atomic<std::size_t> next_job = 0;
+        std::atomic<std::size_t> finished_jobs = 0;
 
+        /// number of workers that have picked up the current job, run() can't return until they are done
+        std::size_t active_workers = 0;
+        std::uint64_t generation = 0;
+        bool quit = false;
+    };
 
+    /** Allocator for objects of a single size.
+     * Memory is taken from the heap in slabs that are kept until the pool is destroyed,
+     * freed objects are put on a free list and reused by the next allocation.
+    */
+    struct ObjectPool
+    {
+        struct Stats
+        {
+            /// objects handed out by the pool
+            std::size_t allocations = 0;
 
+            /// objects returned to the pool
+            std::size_t frees = 0;
 
-    ///////////////////////////////////////////////////////////////////////////////////////////////
-    // enums
+            /// number of calls to free/free_batch, each takes the lock once
+            std::size_t batch_frees = 0;
 
-    enum class UpdateStage
-    {
-        start_frame,
-        before_physics,
-        physics,
-        after_physics,
-        end_frame
+            /// heap allocations made by the pool
+            std::size_t slab_allocations = 0;
+        };
+
+        ObjectPool(std::size_t object_size, std::size_t object_alignment, std::size_t objects_per_slab = 64);
+        ~ObjectPool();
+
+        ObjectPool(const ObjectPool&) = delete;
+        void operator=(const ObjectPool&) = delete;
+
+        void* allocate();
+        void free(void* memory);
+        void free_batch(void* const* memory, std::size_t count);
+
+        Stats get_stats() const;
+
+    private:
+        struct FreeNode { FreeNode* next; };
+
+        std::size_t size;
+        std::size_t alignment;
+        std::size_t slab_count;
+
+        mutable std::mutex mutex;
+        FreeNode* free_list = nullptr;
+        std::vector<void*> slabs;
+        Stats stats;
     };
-    constexpr unsigned int UpdateStageCount = static_cast<unsigned int>(UpdateStage::end_frame) + 1;
 
-    enum class EntityState
+    /// Index + generation, cheap to copy and can be passed between threads.
+    template<typename T>
+    struct Handle
     {
-        /// all components are unloaded
-        unloaded,
-        
-        /// all components are loaded
-        loaded,
-        
-        /// entity has been "turned on" in the world and entity components have been registered with all systems
-        activated
+        std::uint32_t index = 0;
+
+        /// 0 is never used as a generation so a default handle is always invalid
+        std::uint32_t generation = 0;
+
+        bool operator==(const Handle& rhs) const { return index == rhs.index && generation == rhs.generation; }
+        bool operator!=(const Handle& rhs) const { return !(*this == rhs); }
     };
 
-    enum class ComponentState
+    /** Maps Handle to objects.
+     * Lookup is O(1) and lock free, add and remove take a lock.
+     * Slots are stored in pages that never move so lookup is safe while other threads add or remove.
+     * When a object is removed the generation of the slot is increased and all old handles become invalid.
+    */
+    template<typename T>
+    struct HandleTable
     {
-        /// initial state
-        unloaded,
-
-        /// resource load is in progress
-        loading,
+        static constexpr std::size_t page_size = 4096;
+        static constexpr std::size_t max_pages = 1024;
 
-        /// all resources loaded successfully
-        loaded,
+        HandleTable() = default;
+        ~HandleTable();
 
-        /// some or all resources failed to load
-        load_failed,
+        HandleTable(const HandleTable&) = delete;
+        void operator=(const HandleTable&) = delete;
 
-        /// component has been initialized (automatically called after loading successfull)
-        initialized
-    };
+        Handle<T> add(T* object);
+        void remove(Handle<T> handle);
 
+        /// point a valid handle to a new address, used when the object is moved
+        void replace(Handle<T> handle, T* object);
 
+        /// null if the handle is invalid or the object has been removed
+        T* get(Handle<T> handle) const;
+        bool is_valid(Handle<T> handle) const { return get(handle) != nullptr; }
 
+    private:
+        struct Slot
+        {
+            std::atomic<std::uint32_t> generation = 1;
+            std::atomic<T*> object = nullptr;
+        };
 
-    ///////////////////////////////////////////////////////////////////////////////////////////////
-    // "headers"
+        Slot* get_slot(std::uint32_t index) const;
 
-    struct Alive
-    {
-        void kill();
-        void update_for_frame();
+        std::array<std::atomic<Slot*>, max_pages> pages = {};
 
-        bool is_pending_removal() const;
-        bool delete_owner() const;
-    private:
-        int health = 0;
+        std::mutex mutex;
+        std::vector<std::uint32_t> free_indices;
+        std::uint32_t slot_count = 0;
     };
 
+    template<typename T>
+    HandleTable<T>::~HandleTable()
+    {
+        for(auto& page: pages)
+        {
+            delete[] page.load();
+        }
+    }
 
-    // assume there's a Alive called alive on T
     template<typename T>
-    void update_and_remove_alives
-    (
-        std::vector<std::unique_ptr<T>>* alives,
-        std::vector<std::unique_ptr<T>>* deads
-    )
+    typename HandleTable<T>::Slot* HandleTable<T>::get_slot(std::uint32_t index) const
     {
-        core::update_and_erase(deads,
-            [](std::unique_ptr<T>& c) -> bool
-            {
-                c->alive.update_for_frame();
-                return c->alive.delete_owner();
-            }
-        );
-        core::update_and_erase(alives,
-            [deads](std::unique_ptr<T>& c) -> bool
-            {
-                c->alive.update_for_frame();
-                if(c->alive.is_pending_removal())
-                {
-                    // move to dead to keep alive for a few more frames
-                    deads->emplace_back(std::move(c));
-                    return true;
-                }
-                else
-                {
-                    return false;
-                }
+        const std::size_t page_index = index / page_size;
+        if(page_index >= max_pages) { return nullptr; }
+        Slot* page = pages[page_index].load(std::memory_order_acquire);
+        if(page == nullptr) { return nullptr; }
+        return &page[index % page_size];
+    }
+
+    template<typename T>
+    Handle<T> HandleTable<T>::add(T* object)
+    {
+        assert(object != nullptr);
+        std::lock_guard<std::mutex> lock(mutex);
+
+        std::uint32_t index = 0;
+        if(free_indices.empty() == false)
+        {
+            index = free_indices.back();
+            free_indices.pop_back();
+        }
+        else
+        {
+            index = slot_count;
+            slot_count += 1;
+            const std::size_t page_index = index / page_size;
+            assert(page_index < max_pages && "too many objects");
+            if(pages[page_index].load() == nullptr)
+            {
+                pages[page_index].store(new Slot[page_size], std::memory_order_release);
             }
-        );
+        }
+
+        Slot* slot = get_slot(index);
+        slot->object.store(object);
+        return {index, slot->generation.load()};
     }
 
+    template<typename T>
+    void HandleTable<T>::remove(Handle<T> handle)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Slot* slot = get_slot(handle.index);
+        if(slot == nullptr || slot->generation.load() != handle.generation) { return; }
+
+        // clear before bumping the generation, get() verifies the generation after reading the object
+        slot->object.store(nullptr);
+        std::uint32_t generation = handle.generation + 1;
+        if(generation == 0) { generation = 1; }
+        slot->generation.store(generation);
+        free_indices.emplace_back(handle.index);
+    }
 
-    struct EntitySystemWithPrio
+    template<typename T>
+    void HandleTable<T>::replace(Handle<T> handle, T* object)
     {
-        EntitySystemWithPrio(EntitySystem* s, int p);
+        std::lock_guard<std::mutex> lock(mutex);
+        Slot* slot = get_slot(handle.index);
+        assert(slot != nullptr && slot->generation.load() == handle.generation);
+        slot->object.store(object);
+    }
 
-        EntitySystem* system;
-        int prio;
-    };
+    template<typename T>
+    T* HandleTable<T>::get(Handle<T> handle) const
+    {
+        if(handle.generation == 0) { return nullptr; }
+        const Slot* slot = get_slot(handle.index);
+        if(slot == nullptr) { return nullptr; }
 
-    struct EntitySystemUpdateStageList
+        if(slot->generation.load() != handle.generation) { return nullptr; }
+        T* object = slot->object.load();
+
+        // the slot could have been removed and reused while we read the object
+        if(slot->generation.load() != handle.generation) { return nullptr; }
+        return object;
+    }
+
+    /** Threads that run tasks in the order they were pushed.
+     * Unlike WorkerPool nothing waits for the tasks, used for io.
+    */
+    struct TaskQueue
     {
-        void update(UpdateStage stage);
-        void add(EntitySystem* sys, int prio);
-        void remove(EntitySystem* sys);
+        explicit TaskQueue(std::size_t thread_count);
+
+        /// waits for the running tasks, tasks that haven't started are dropped
+        ~TaskQueue();
+
+        TaskQueue(const TaskQueue&) = delete;
+        void operator=(const TaskQueue&) = delete;
+
+        void push(std::function<void ()> task);
 
     private:
-        std::vector<EntitySystemWithPrio> systems;
-        // can't iterate a std::priority_queue so let's not use that for now
+        void thread_main();
+
+        std::vector<std::thread> threads;
+        std::mutex mutex;
+        std::condition_variable task_available;
+        std::deque<std::function<void ()>> tasks;
+        bool quit = false;
     };
 
-    /** Updates EntitySystem in the right order.
-    */
-    struct EntitySystemUpdate
+    /// number of cores - 1, the main thread is the last one
+    std::size_t default_worker_count()
     {
-        std::array<EntitySystemUpdateStageList, UpdateStageCount> systems;
+        const auto cores = std::thread::hardware_concurrency();
+        return cores > 1 ? cores - 1 : 0;
+    }
 
-        void update(UpdateStage stage);
-        void add(EntitySystem* sys, UpdateStage stage, int prio);
-        void remove(EntitySystem* sys, UpdateStage stage);
-    };
+    WorkerPool::WorkerPool(std::size_t worker_count)
+    {
+        workers.reserve(worker_count);
+        for(std::size_t index=0; index<worker_count; index+=1)
+        {
+            workers.emplace_back([this, index](){ worker_main(index + 1); });
+        }
+    }
 
+    WorkerPool::~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        work_available.notify_all();
+        for(auto& w: workers)
+        {
+            w.join();
+        }
+    }
 
-    /**
-     * A generic thing that you can't derive from.
-     * @todo flesh out documentation
-    */
-    struct Entity
+    std::size_t WorkerPool::get_worker_count() const
     {
-        core::Guid guid;
-        std::vector<std::unique_ptr<Component>> components;
-        std::vector<std::unique_ptr<Component>> dead_components;
-        EntitySystemUpdate systems;
+        return workers.size();
+    }
 
-        // dynamically add/remove components
+    namespace
+    {
+        thread_local std::size_t worker_thread_index = 0;
+    }
 
-        Component* root_component = nullptr;
-        bool is_spatial_entity() const { return root_component != nullptr; }
+    std::size_t WorkerPool::get_thread_index()
+    {
+        return worker_thread_index;
+    }
 
-        /** Turn the enity on in the world.
-         * * register entity for all systems
-         * * create update list
-         * * create entity attachment
-         * 
-         * activate components/local systems paralellized with one enity per thread
-         * activate world systems with one system per thread
-        */ 
-        void activate()
+    void WorkerPool::run(std::size_t count, const std::function<void (std::size_t)>& job)
+    {
+        if(count == 0) { return; }
+        if(workers.empty() || count == 1)
         {
-            // thread safe?:
-            //   register each componet with all local systems
-            //   create per-stage local system update lists
-            //   creates entity attachment (if required)
-            // not thread safe:
-            //   registers each componet with all global systems
+            for(std::size_t index=0; index<count; index+=1) { job(index); }
+            return;
         }
 
-        /// Turn the entity off, remove entity from all systems
-        void deactive();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current_job = &job;
+            job_count = count;
+            next_job = 0;
+            finished_jobs = 0;
+            generation += 1;
+        }
+        work_available.notify_all();
 
-        void update(UpdateStage stage);
+        run_jobs(job, count);
 
-        /// Load all components (resource, memory...)
-        void load();
+        std::unique_lock<std::mutex> lock(mutex);
+        work_done.wait(lock, [this, count]() { return finished_jobs == count && active_workers == 0; });
+        current_job = nullptr;
+    }
 
-        /// Unload all components (resource, memory...)
-        void unload();
+    void WorkerPool::worker_main(std::size_t thread_index)
+    {
+        worker_thread_index = thread_index;
+        std::uint64_t handled_generation = 0;
+        while(true)
+        {
+            const std::function<void (std::size_t)>* job = nullptr;
+            std::size_t count = 0;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                work_available.wait(lock, [&]() { return quit || (current_job != nullptr && generation != handled_generation); });
+                if(quit) { return; }
+                handled_generation = generation;
+                job = current_job;
+                count = job_count;
+                active_workers += 1;
+            }
 
-        Alive alive;
-    };
+            run_jobs(*job, count);
 
-    void attach(World* world, Entity* parent_id, Entity* child_id);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                active_workers -= 1;
+            }
+            work_done.notify_all();
+        }
+    }
 
+    // ------------------------------------------------------------------------
+    // ObjectPool
 
-    /** Basic data storage.
-     * 
-     * Properties that define settings and resource.
-     * 
-     * * Components have no access to other components.
-     * * Components have no access to the entity.
-     * * Components have no default update.
-     * * Inheritance of components is allowed.
-     * * Can contain logic if needed (example: animation graph component contains everything related to the animation graph) and be viewed as a black box.
-     *
-     * Loading state switching between @ref ComponentState
-        ```graphviz
-        digraph G
-        {
-            unloaded -> loading [label="load()"];
-            loading -> unloaded [label="unload()"];
+    ObjectPool::ObjectPool(std::size_t object_size, std::size_t object_alignment, std::size_t objects_per_slab)
+        : size(std::max(object_size, sizeof(FreeNode)))
+        , alignment(std::max(object_alignment, alignof(FreeNode)))
+        , slab_count(objects_per_slab)
+    {
+        // round up so every object in the slab is aligned
+        size = (size + alignment - 1) / alignment * alignment;
+    }
 
-            loading_failed -> unloaded [label="unload()"];
-            loaded -> unloaded [label="unload()"];
+    ObjectPool::~ObjectPool()
+    {
+        assert(stats.allocations == stats.frees && "objects are still alive");
+        for(void* slab: slabs)
+        {
+            ::operator delete(slab, std::align_val_t{alignment});
+        }
+    }
 
-            loading -> loading_failed;
-            loading -> loaded;
+    void* ObjectPool::allocate()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(free_list == nullptr)
+        {
+            auto* slab = static_cast<unsigned char*>(::operator new(size * slab_count, std::align_val_t{alignment}));
+            slabs.emplace_back(slab);
+            stats.slab_allocations += 1;
 
-            loaded -> initialized[label="initialize()"];
-            initialized -> loaded[label="shutdown()"];
+            // push in reverse so objects are handed out in address order
+            for(std::size_t index=slab_count; index>0; index-=1)
+            {
+                auto* node = reinterpret_cast<FreeNode*>(slab + (index-1) * size);
+                node->next = free_list;
+                free_list = node;
+            }
         }
-        ```
-    */
-    struct Component
+
+        FreeNode* node = free_list;
+        free_list = node->next;
+        stats.allocations += 1;
+        return node;
+    }
+
+    void ObjectPool::free(void* memory)
     {
-        virtual ~Component() = default;
+        free_batch(&memory, 1);
+    }
 
-        core::Guid guid;
+    void ObjectPool::free_batch(void* const* memory, std::size_t count)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(std::size_t index=0; index<count; index+=1)
+        {
+            auto* node = static_cast<FreeNode*>(memory[index]);
+            node->next = free_list;
+            free_list = node;
+        }
+        stats.frees += count;
+        stats.batch_frees += 1;
+    }
 
-        /// for debug and tools
-        std::string name;
+    ObjectPool::Stats ObjectPool::get_stats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
 
-        Alive alive;
+    // ------------------------------------------------------------------------
+    // TaskQueue
 
-        // settings that are serialized
-        // resources that are loaded
+    TaskQueue::TaskQueue(std::size_t thread_count)
+    {
+        threads.reserve(thread_count);
+        for(std::size_t index=0; index<thread_count; index+=1)
+        {
+            threads.emplace_back([this](){ thread_main(); });
+        }
+    }
 
-        virtual void on_load(); virtual void on_unload();
-        virtual void on_initialize(); virtual void on_shutdown();
-    };
+    TaskQueue::~TaskQueue()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+            tasks.clear();
+        }
+        task_available.notify_all();
+        for(auto& t: threads)
+        {
+            t.join();
+        }
+    }
 
+    void TaskQueue::push(std::function<void ()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.emplace_back(std::move(task));
+        }
+        task_available.notify_one();
+    }
 
-    struct ComponentType
+    void TaskQueue::thread_main()
     {
-        core::HashedStringView name;
-        
-        /// can the enttity have many components of this type
-        bool max_one_per_entity;
+        while(true)
+        {
+            std::function<void ()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                task_available.wait(lock, [this]() { return quit || tasks.empty() == false; });
+                if(quit) { return; }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
 
-        virtual Component* create() = 0;
-    };
+    // ------------------------------------------------------------------------
+    // WorkerPool (cont.)
 
-    /** Creates a new componet type for built-in components.
-     * 
-     * ```
-     * CUSTOM_COMPONENT(CustomComponent, custom, "custom-name");
-     * ```
-    */
-    #define CUSTOM_COMPONENT(TYPE, NAME, HASH)\
-    struct TYPE : ComponentType\
-    {\
-        constexpr TYPE() : ComponentType{HASH} {}\
-        std::unique_ptr<Component> create() const override;\
-    };\
-    constexpr TYPE NAME;
+    void WorkerPool::run_jobs(const std::function<void (std::size_t)>& job, std::size_t count)
+    {
+        for(std::size_t index = next_job++; index < count; index = next_job++)
+        {
+            job(index);
+            finished_jobs += 1;
+        }
+    }
 
-    /** Helpful factory to create Component.
+    /** Dynamic bounding volume hierarchy of axis aligned boxes, a dynamic AABB tree in the style of Box2D.
+     * Leaves store a enlarged box so objects that only move a little doesn't touch the tree,
+     * inserting picks the sibling with the lowest surface area cost and rotations keep the tree balanced.
+     * Queries are const and can run on several threads at the same time as long as the tree isn't modified.
     */
-    struct ComponentFactory
+    struct DynamicBvh
     {
-        void add(const ComponentType* name);
-        const ComponentType* from_name_or_null(core::HashedStringView name) const;
-    private:
-        std::unordered_map<core::HashedStringView, const ComponentType*> types;
-    };
+        static constexpr std::uint32_t null_node = ~std::uint32_t{0};
 
+        /// how much the leaf boxes are enlarged
+        explicit DynamicBvh(float margin);
 
-    /**
-     * This is the only components that can reference other components.
-     * All components in graph must belong to the same entity (so same thread), with the exception of spatial entities that are attached to other spatial entitites.
-     * It's still safe since it's hidden from the user and sheduling ensures it's updated in order and on the same thread.
-    */
-    struct SpatialComponent : Component
-    {
-    private:
-        core::mat4f _local_transform;
-        core::mat4f _global_transform;
+        /// returns the proxy, user is what the queries report
+        std::uint32_t add(const Aabb& box, std::uint32_t user);
+        void remove(std::uint32_t proxy);
 
-    public:
-        void set_local_transform(const core::mat4f& m) { _local_transform = m; update_world_transform(); }
-        
+        /// returns false if the box still fits in the enlarged box and the tree wasn't changed
+        bool move(std::uint32_t proxy, const Aabb& box);
 
-        const core::mat4f& get_local_transform() { return _local_transform; };
-        const core::mat4f& get_global_transform() { return _global_transform; };
+        std::size_t get_proxy_count() const { return proxy_count; }
+        int get_height() const { return root == null_node ? 0 : nodes[root].height; }
+
+        /// calls on_hit(user) for each box that touch the shape, boxes are tested with the exact box and not the enlarged one
+        template<typename F> void query(const Frustum& frustum, F&& on_hit) const;
+        template<typename F> void query(const Sphere& sphere, F&& on_hit) const;
+        template<typename F> void query(const Ray& ray, F&& on_hit) const;
 
-        void update_world_transform()
+    private:
+        struct Node
         {
-            // calculate world transform based on world
-            // update world bounds
+            /// enlarged for leaves
+            Aabb box;
 
-            // update world transforms on children
-            for(SpatialComponent* child: children)
-            {
-                child->update_world_transform();
-            }
-        }
+            /// the exact box, only used for leaves
+            Aabb tight;
 
-    private:
-        /// non-inclusive bounds in local space
-        core::Obb local_bounds;
+            /// next free node when on the free list
+            std::uint32_t parent = null_node;
+            std::array<std::uint32_t, 2> children = {null_node, null_node};
+            std::uint32_t user = 0;
 
-        /// non-inclusive bounds in world space
-        core::Obb world_bounds;
+            /// 0 for leaves, -1 for free nodes
+            std::int32_t height = -1;
 
-        // parent spatial components + socket attachment
-        Entity* parent;
+            bool is_leaf() const { return children[0] == null_node; }
+        };
 
-        /// can reference other spatial components: https://youtu.be/jjEsB611kxs?t=6639
-        /// @todo find out if this can reference entities in other components or not
-        std::vector<SpatialComponent*> children;
+        std::uint32_t allocate_node();
+        void free_node(std::uint32_t node);
+
+        void insert_leaf(std::uint32_t leaf);
+        void remove_leaf(std::uint32_t leaf);
+
+        /// refit and rebalance from node up to the root
+        void fix_upwards(std::uint32_t node);
+
+        /// rotate if the children heights differ by more than 1, returns the node that replaced this
+        std::uint32_t balance(std::uint32_t node);
+
+        /// classify(box) returns a Containment, inside subtrees are reported without further tests
+        template<typename C, typename F> void traverse(C&& classify, F&& on_hit) const;
+
+        std::vector<Node> nodes;
+        std::uint32_t root = null_node;
+        std::uint32_t free_list = null_node;
+        std::size_t proxy_count = 0;
+        float margin;
     };
 
+    // ------------------------------------------------------------------------
+    // DynamicBvh
 
-    /** Required and optional components for EntitySystem and WorldSystem.
-    Contains requireed and optional components for a system to work.
-    With tooling a user can see if the added system is missing components.
+    DynamicBvh::DynamicBvh(float m)
+        : margin(m)
+    {
+    }
 
-    Example: Character animation system requires Animation and Skeletal Mesh and has a optional Cloth.
-    */
-    struct RequestedComponents
+    std::uint32_t DynamicBvh::allocate_node()
     {
-        std::vector<const ComponentType*> required;
-        std::vector<const ComponentType*> optional;
-    };
+        if(free_list == null_node)
+        {
+            nodes.emplace_back();
+            return static_cast<std::uint32_t>(nodes.size() - 1);
+        }
 
-    /** A local system for a entity.
-     * 
-     * only one system of a specified type is allowed per entity
-     * 
-     * * It's manually added to a entity
-     * * It can have entity specific data
-     * * It can't reference other entities
+        const std::uint32_t node = free_list;
+        free_list = nodes[node].parent;
+        nodes[node] = Node{};
+        return node;
+    }
+
+    void DynamicBvh::free_node(std::uint32_t node)
+    {
+        nodes[node].parent = free_list;
+        nodes[node].height = -1;
+        free_list = node;
+    }
+
+    std::uint32_t DynamicBvh::add(const Aabb& box, std::uint32_t user)
+    {
+        const std::uint32_t leaf = allocate_node();
+        Node& node = nodes[leaf];
+        node.box = expand(box, margin);
+        node.tight = box;
+        node.user = user;
+        node.height = 0;
+        insert_leaf(leaf);
+        proxy_count += 1;
+        return leaf;
+    }
+
+    void DynamicBvh::remove(std::uint32_t proxy)
+    {
+        assert(nodes[proxy].is_leaf() && nodes[proxy].height == 0);
+        remove_leaf(proxy);
+        free_node(proxy);
+        proxy_count -= 1;
+    }
+
+    bool DynamicBvh::move(std::uint32_t proxy, const Aabb& box)
+    {
+        assert(nodes[proxy].is_leaf() && nodes[proxy].height == 0);
+        nodes[proxy].tight = box;
+        if(contains(nodes[proxy].box, box)) { return false; }
+
+        remove_leaf(proxy);
+        nodes[proxy].box = expand(box, margin);
+        insert_leaf(proxy);
+        return true;
+    }
+
+    void DynamicBvh::insert_leaf(std::uint32_t leaf)
+    {
+        if(root == null_node)
+        {
+            root = leaf;
+            nodes[root].parent = null_node;
+            return;
+        }
+
+        // find the best sibling by walking down the tree and picking the cheapest child
+        const Aabb box = nodes[leaf].box;
+        std::uint32_t index = root;
+        while(nodes[index].is_leaf() == false)
+        {
+            const Node& node = nodes[index];
+            const float area = surface_area(node.box);
+            const float combined_area = surface_area(merge(node.box, box));
+
+            // cost of creating a new parent for this node and the leaf
+            const float cost = 2.0f * combined_area;
+
+            // minimum cost of pushing the leaf further down
+            const float inheritance_cost = 2.0f * (combined_area - area);
+
+            const auto child_cost = [&](std::uint32_t child_index)
+            {
+                const Node& child = nodes[child_index];
+                const float merged = surface_area(merge(box, child.box));
+                return (child.is_leaf() ? merged : merged - surface_area(child.box)) + inheritance_cost;
+            };
+            const float cost0 = child_cost(node.children[0]);
+            const float cost1 = child_cost(node.children[1]);
+
+            if(cost < cost0 && cost < cost1) { break; }
+            index = cost0 < cost1 ? node.children[0] : node.children[1];
+        }
+
+        const std::uint32_t sibling = index;
+        const std::uint32_t new_parent = allocate_node();
+        const std::uint32_t old_parent = nodes[sibling].parent;
+
+        Node& parent = nodes[new_parent];
+        parent.parent = old_parent;
+        parent.box = merge(box, nodes[sibling].box);
+        parent.height = nodes[sibling].height + 1;
+        parent.children = {sibling, leaf};
+
+        if(old_parent != null_node)
+        {
+            auto& children = nodes[old_parent].children;
+            children[children[0] == sibling ? 0 : 1] = new_parent;
+        }
+        else
+        {
+            root = new_parent;
+        }
+        nodes[sibling].parent = new_parent;
+        nodes[leaf].parent = new_parent;
+
+        fix_upwards(new_parent);
+    }
+
+    void DynamicBvh::remove_leaf(std::uint32_t leaf)
+    {
+        if(leaf == root)
+        {
+            root = null_node;
+            return;
+        }
+
+        const std::uint32_t parent = nodes[leaf].parent;
+        const std::uint32_t grand_parent = nodes[parent].parent;
+        const auto& parent_children = nodes[parent].children;
+        const std::uint32_t sibling = parent_children[0] == leaf ? parent_children[1] : parent_children[0];
+
+        // the sibling replaces the parent
+        if(grand_parent != null_node)
+        {
+            auto& children = nodes[grand_parent].children;
+            children[children[0] == parent ? 0 : 1] = sibling;
+            nodes[sibling].parent = grand_parent;
+            free_node(parent);
+            fix_upwards(grand_parent);
+        }
+        else
+        {
+            root = sibling;
+            nodes[sibling].parent = null_node;
+            free_node(parent);
+        }
+    }
+
+    void DynamicBvh::fix_upwards(std::uint32_t index)
+    {
+        while(index != null_node)
+        {
+            index = balance(index);
+
+            Node& node = nodes[index];
+            const Node& child0 = nodes[node.children[0]];
+            const Node& child1 = nodes[node.children[1]];
+            node.height = 1 + std::max(child0.height, child1.height);
+            node.box = merge(child0.box, child1.box);
+
+            index = node.parent;
+        }
+    }
+
+    std::uint32_t DynamicBvh::balance(std::uint32_t a_index)
+    {
+        Node& a = nodes[a_index];
+        if(a.is_leaf() || a.height < 2) { return a_index; }
+
+        const std::uint32_t b_index = a.children[0];
+        const std::uint32_t c_index = a.children[1];
+        Node& b = nodes[b_index];
+        Node& c = nodes[c_index];
+
+        const std::int32_t diff = c.height - b.height;
+        if(diff >= -1 && diff <= 1) { return a_index; }
+
+        // the highest child (up) takes the place of a, a gets the lowest grand child
+        // and up keeps the highest grand child
+        const int up_side = diff > 1 ? 1 : 0;
+        const std::uint32_t up_index = a.children[up_side];
+        Node& up = nodes[up_index];
+        Node& other = nodes[a.children[1 - up_side]];
+
+        const std::uint32_t f_index = up.children[0];
+        const std::uint32_t g_index = up.children[1];
+        Node& f = nodes[f_index];
+        Node& g = nodes[g_index];
+
+        up.children[0] = a_index;
+        up.parent = a.parent;
+        a.parent = up_index;
+
+        if(up.parent != null_node)
+        {
+            auto& children = nodes[up.parent].children;
+            children[children[0] == a_index ? 0 : 1] = up_index;
+        }
+        else
+        {
+            root = up_index;
+        }
+
+        const bool keep_f = f.height > g.height;
+        const std::uint32_t kept_index = keep_f ? f_index : g_index;
+        const std::uint32_t moved_index = keep_f ? g_index : f_index;
+        Node& kept = nodes[kept_index];
+        Node& moved = nodes[moved_index];
+
+        up.children[1] = kept_index;
+        a.children[up_side] = moved_index;
+        moved.parent = a_index;
+
+        a.box = merge(other.box, moved.box);
+        up.box = merge(a.box, kept.box);
+        a.height = 1 + std::max(other.height, moved.height);
+        up.height = 1 + std::max(a.height, kept.height);
+
+        return up_index;
+    }
+
+    template<typename C, typename F>
+    void DynamicBvh::traverse(C&& classify, F&& on_hit) const
+    {
+        if(root == null_node) { return; }
+
+        // the tree is balanced so the stack is never deeper than the height + 1
+        // the top bit is set for nodes that are completely inside the shape
+        constexpr std::uint32_t inside_bit = 1u << 31;
+        std::array<std::uint32_t, 128> stack;
+        std::size_t stack_size = 0;
+        stack[stack_size++] = root;
+
+        while(stack_size > 0)
+        {
+            const std::uint32_t entry = stack[--stack_size];
+            const std::uint32_t index = entry & ~inside_bit;
+            const Node& node = nodes[index];
+
+            std::uint32_t child_bit = inside_bit;
+            if((entry & inside_bit) == 0)
+            {
+                const Containment containment = classify(node.is_leaf() ? node.tight : node.box);
+                if(containment == Containment::outside) { continue; }
+                child_bit = containment == Containment::inside ? inside_bit : 0;
+            }
+
+            if(node.is_leaf())
+            {
+                on_hit(node.user);
+            }
+            else
+            {
+                assert(stack_size + 2 <= stack.size());
+                stack[stack_size++] = node.children[1] | child_bit;
+                stack[stack_size++] = node.children[0] | child_bit;
+            }
+        }
+    }
+
+    template<typename F>
+    void DynamicBvh::query(const Frustum& frustum, F&& on_hit) const
+    {
+        traverse([&frustum](const Aabb& box) { return classify(frustum, box); }, on_hit);
+    }
+
+    template<typename F>
+    void DynamicBvh::query(const Sphere& sphere, F&& on_hit) const
+    {
+        traverse([&sphere](const Aabb& box)
+        {
+            return intersects(sphere, box) ? Containment::intersecting : Containment::outside;
+        }, on_hit);
+    }
+
+    template<typename F>
+    void DynamicBvh::query(const Ray& ray, F&& on_hit) const
+    {
+        const vec3f inverse_direction = {1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z};
+        traverse([&ray, &inverse_direction](const Aabb& box)
+        {
+            return intersects(ray, inverse_direction, box) ? Containment::intersecting : Containment::outside;
+        }, on_hit);
+    }
+
+    /** Low overhead scoped timings.
+     * Each thread records to its own ring buffer, when full the oldest events are overwritten.
+     * Names must outlive the profiler (string literals or type names).
+    */
+    struct Profiler
+    {
+        struct Event
+        {
+            std::string_view name;
+            std::uint64_t start_ns;
+            std::uint64_t end_ns;
+        };
+
+        static constexpr std::size_t events_per_thread = 64 * 1024;
+
+        static std::uint64_t now_ns();
+        static void record(std::string_view name, std::uint64_t start_ns, std::uint64_t end_ns);
+
+        /// export all events in the chrome trace event format (chrome://tracing or ui.perfetto.dev), don't call while threads are recording
+        static bool write_chrome_trace(const std::string& path);
+
+        /// total time per scope name over all threads, the entity system scopes are named after the EntitySystemType
+        struct Summary
+        {
+            std::string_view name;
+            std::size_t count;
+            std::uint64_t total_ns;
+            std::uint64_t max_ns;
+        };
+
+        /// aggregate the events still in the buffers, sorted on total time, don't call while threads are recording
+        static std::vector<Summary> get_summary();
+
+        /// get_summary as csv (name,count,total_ms,average_ms,max_ms)
+        static bool write_summary(const std::string& path);
+        static void print_summary();
+
+        /// remove all recorded events, don't call while threads are recording
+        static void clear();
+    };
+
+    struct ProfileScope
+    {
+        explicit ProfileScope(std::string_view n) : name(n), start_ns(Profiler::now_ns()) {}
+        ~ProfileScope() { Profiler::record(name, start_ns, Profiler::now_ns()); }
+
+        ProfileScope(const ProfileScope&) = delete;
+        void operator=(const ProfileScope&) = delete;
+
+        std::string_view name;
+        std::uint64_t start_ns;
+    };
+
+#if ENTITY_PROFILER
+    #define PROFILE_CONCAT_IMPL(A, B) A##B
+    #define PROFILE_CONCAT(A, B) PROFILE_CONCAT_IMPL(A, B)
+    #define PROFILE_SCOPE(NAME) core::ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__){NAME}
+#else
+    #define PROFILE_SCOPE(NAME) do {} while(false)
+#endif
+
+    namespace
+    {
+        struct ProfileThread
+        {
+            std::uint32_t thread_id;
+            std::vector<Profiler::Event> events = std::vector<Profiler::Event>(Profiler::events_per_thread);
+
+            /// total recorded, the ring index is count % size
+            std::size_t count = 0;
+        };
+
+        struct ProfileThreads
+        {
+            std::mutex mutex;
+            std::vector<std::unique_ptr<ProfileThread>> threads;
+        };
+
+        ProfileThreads& get_profile_threads()
+        {
+            static ProfileThreads threads;
+            return threads;
+        }
+
+        ProfileThread* get_profile_thread()
+        {
+            // the buffer is owned by the global list so it outlives the thread
+            thread_local ProfileThread* thread = nullptr;
+            if(thread == nullptr)
+            {
+                auto& all = get_profile_threads();
+                std::lock_guard<std::mutex> lock(all.mutex);
+                auto t = std::make_unique<ProfileThread>();
+                t->thread_id = static_cast<std::uint32_t>(all.threads.size());
+                thread = all.threads.emplace_back(std::move(t)).get();
+            }
+            return thread;
+        }
+
+        void write_json_string(std::ostream& out, std::string_view str)
+        {
+            out << '"';
+            for(const char c: str)
+            {
+                switch(c)
+                {
+                case '"': out << "\\\""; break;
+                case '\\': out << "\\\\"; break;
+                case '\n': out << "\\n"; break;
+                case '\r': out << "\\r"; break;
+                case '\t': out << "\\t"; break;
+                default:
+                    if(static_cast<unsigned char>(c) < 0x20)
+                    {
+                        constexpr char hex[] = "0123456789abcdef";
+                        out << "\\u00" << hex[(c >> 4) & 0xF] << hex[c & 0xF];
+                    }
+                    else
+                    {
+                        out << c;
+                    }
+                    break;
+                }
+            }
+            out << '"';
+        }
+    }
+
+    std::uint64_t Profiler::now_ns()
+    {
+        static const auto epoch = std::chrono::steady_clock::now();
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count());
+    }
+
+    void Profiler::record(std::string_view name, std::uint64_t start_ns, std::uint64_t end_ns)
+    {
+        ProfileThread* thread = get_profile_thread();
+        thread->events[thread->count % thread->events.size()] = {name, start_ns, end_ns};
+        thread->count += 1;
+    }
+
+    bool Profiler::write_chrome_trace(const std::string& path)
+    {
+        std::ofstream out(path);
+        if(!out) { return false; }
+
+        auto& all = get_profile_threads();
+        std::lock_guard<std::mutex> lock(all.mutex);
+
+        out << std::fixed << std::setprecision(3);
+        out << "{\"traceEvents\":[\n";
+        bool first = true;
+        for(const auto& thread: all.threads)
+        {
+            const std::size_t size = thread->events.size();
+            const std::size_t start = thread->count > size ? thread->count - size : 0;
+            for(std::size_t index=start; index<thread->count; index+=1)
+            {
+                const Event& e = thread->events[index % size];
+                if(first == false) { out << ",\n"; }
+                first = false;
+
+                // timestamps are in microseconds
+                out << "{\"name\":";
+                write_json_string(out, e.name);
+                out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->thread_id
+                    << ",\"ts\":" << static_cast<double>(e.start_ns) / 1000.0
+                    << ",\"dur\":" << static_cast<double>(e.end_ns - e.start_ns) / 1000.0 << "}";
+            }
+        }
+        out << "\n]}\n";
+        return static_cast<bool>(out);
+    }
+
+    std::vector<Profiler::Summary> Profiler::get_summary()
+    {
+        auto& all = get_profile_threads();
+        std::lock_guard<std::mutex> lock(all.mutex);
+
+        std::unordered_map<std::string_view, std::size_t> index_of;
+        std::vector<Summary> summary;
+        for(const auto& thread: all.threads)
+        {
+            const std::size_t size = thread->events.size();
+            const std::size_t start = thread->count > size ? thread->count - size : 0;
+            for(std::size_t index=start; index<thread->count; index+=1)
+            {
+                const Event& e = thread->events[index % size];
+                const auto [found, inserted] = index_of.try_emplace(e.name, summary.size());
+                if(inserted) { summary.push_back({e.name, 0, 0, 0}); }
+
+                Summary& s = summary[found->second];
+                const std::uint64_t duration = e.end_ns - e.start_ns;
+                s.count += 1;
+                s.total_ns += duration;
+                s.max_ns = std::max(s.max_ns, duration);
+            }
+        }
+
+        std::sort(summary.begin(), summary.end(), [](const Summary& lhs, const Summary& rhs) { return lhs.total_ns > rhs.total_ns; });
+        return summary;
+    }
+
+    bool Profiler::write_summary(const std::string& path)
+    {
+        std::ofstream out(path);
+        if(!out) { return false; }
+
+        out << std::fixed << std::setprecision(3);
+        out << "name,count,total_ms,average_ms,max_ms\n";
+        for(const auto& s: get_summary())
+        {
+            // names are identifiers, quote them anyway so a comma doesn't break the columns
+            out << '"' << s.name << "\"," << s.count
+                << ',' << static_cast<double>(s.total_ns) / 1e6
+                << ',' << static_cast<double>(s.total_ns) / 1e6 / static_cast<double>(s.count)
+                << ',' << static_cast<double>(s.max_ns) / 1e6 << '\n';
+        }
+        return static_cast<bool>(out);
+    }
+
+    void Profiler::print_summary()
+    {
+        std::printf("  %-24s %8s %12s %12s %12s\n", "name", "count", "total ms", "average ms", "max ms");
+        for(const auto& s: get_summary())
+        {
+            std::printf("  %-24.*s %8zu %12.3f %12.3f %12.3f\n", static_cast<int>(s.name.size()), s.name.data(), s.count,
+                static_cast<double>(s.total_ns) / 1e6,
+                static_cast<double>(s.total_ns) / 1e6 / static_cast<double>(s.count),
+                static_cast<double>(s.max_ns) / 1e6);
+        }
+    }
+
+    void Profiler::clear()
+    {
+        auto& all = get_profile_threads();
+        std::lock_guard<std::mutex> lock(all.mutex);
+        for(auto& thread: all.threads)
+        {
+            thread->count = 0;
+        }
+    }
+}
+
+namespace entity
+{
+
+
+
+
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // forward declare
+
+    struct EntitySystemWithPrio;
+    struct EntitySystemUpdateStageList;
+    struct EntitySystemUpdate;
+    struct EntityUpdatePlan;
+
+    struct WorldSystemWithPrio;
+    struct WorldSystemUpdateStageList;
+    struct WorldSystemUpdate;
+
+    struct Entity;
+    struct Component;
+        struct ComponentType;
+        struct ComponentFactory;
+        struct Archetype;
+        struct ArchetypeChunk;
+        struct ArchetypeStorage;
+    struct SpatialComponent;
+        struct TransformHierarchy;
+        struct SpatialIndex;
+    struct ResourceRequests;
+    struct ActivationCommands;
+    struct WorldCommands;
+    struct QueryCache;
+    struct Snapshot;
+    struct SnapshotWriter;
+    struct SnapshotReader;
+    struct RequestedComponents;
+    struct EntitySystem;
+        struct EntitySystemType;
+        struct EntitySystemFactory;
+    struct WorldSystem;
+        struct WorldSystemType;
+        struct WorldSystemFactory;
+    struct World;
+
+    using EntityHandle = core::Handle<Entity>;
+    using ComponentHandle = core::Handle<Component>;
+
+    /// returns the component to the pool of the ComponentType that created it
+    struct ComponentDeleter { void operator()(Component* c) const; };
+    using ComponentPtr = std::unique_ptr<Component, ComponentDeleter>;
+
+    /// returns the system to the pool of the EntitySystemType that created it
+    struct EntitySystemDeleter { void operator()(EntitySystem* s) const; };
+    using EntitySystemPtr = std::unique_ptr<EntitySystem, EntitySystemDeleter>;
+
+
+
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // enums
+
+    enum class UpdateStage
+    {
+        start_frame,
+        before_physics,
+        physics,
+        after_physics,
+        end_frame
+    };
+    constexpr unsigned int UpdateStageCount = static_cast<unsigned int>(UpdateStage::end_frame) + 1;
+
+    constexpr std::string_view to_string(UpdateStage stage)
+    {
+        switch(stage)
+        {
+        case UpdateStage::start_frame: return "start_frame";
+        case UpdateStage::before_physics: return "before_physics";
+        case UpdateStage::physics: return "physics";
+        case UpdateStage::after_physics: return "after_physics";
+        case UpdateStage::end_frame: return "end_frame";
+        }
+        return "unknown";
+    }
+
+    /** How often the entity systems of a entity are updated.
+     * Lower tiers are spread over the frames so the same number of entities are updated each frame,
+     * the systems get the time since they were last updated as dt.
+    */
+    enum class UpdateTier
+    {
+        every_frame,
+        every_2nd_frame,
+        every_4th_frame,
+
+        /// not updated at all, the time spent dormant isn't included in dt when the entity wakes up
+        dormant
+    };
+
+    /// number of frames between updates, 0 for dormant
+    constexpr std::uint32_t get_update_period(UpdateTier tier)
+    {
+        switch(tier)
+        {
+        case UpdateTier::every_frame: return 1;
+        case UpdateTier::every_2nd_frame: return 2;
+        case UpdateTier::every_4th_frame: return 4;
+        case UpdateTier::dormant: return 0;
+        }
+        return 0;
+    }
+
+    /** A slot is a tier and the frame offset (phase) it's updated on, 1 + 2 + 4 slots for the updating tiers.
+     * A slot with period P and phase p is updated when frame % P == p.
+    */
+    constexpr std::size_t UpdateSlotCount = 7;
+    constexpr std::uint8_t dormant_update_slot = UpdateSlotCount;
+
+    constexpr std::uint8_t get_update_slot(std::uint32_t period, std::uint32_t phase)
+    {
+        return static_cast<std::uint8_t>(period - 1 + phase);
+    }
+
+    constexpr std::uint32_t get_update_slot_period(std::uint8_t slot)
+    {
+        return slot == dormant_update_slot ? 0 : slot < 1 ? 1 : slot < 3 ? 2 : 4;
+    }
+
+    constexpr std::uint32_t get_update_slot_phase(std::uint8_t slot)
+    {
+        return slot == dormant_update_slot ? 0 : slot + 1 - get_update_slot_period(slot);
+    }
+
+    enum class EntityState
+    {
+        /// all components are unloaded
+        unloaded,
+        
+        /// all components are loaded
+        loaded,
+        
+        /// entity has been "turned on" in the world and entity components have been registered with all systems
+        activated
+    };
+
+    enum class ComponentState
+    {
+        /// initial state
+        unloaded,
+
+        /// resource load is in progress
+        loading,
+
+        /// all resources loaded successfully
+        loaded,
+
+        /// some or all resources failed to load
+        load_failed,
+
+        /// component has been initialized (automatically called after loading successfull)
+        initialized
+    };
+
+
+
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // "headers"
+
+    /// set when the object has been killed, it's kept in a ReclaimRing for a few frames before it's deleted
+    struct Alive
+    {
+        void kill();
+        bool is_pending_removal() const;
+    private:
+        bool dead = false;
+    };
+
+
+    /// destroy all components, components of the same type are returned to the pool together
+    void destroy_batch(std::vector<ComponentPtr>* batch);
+
+    /// destroy the entities, all their components are destroyed together first
+    void destroy_batch(std::vector<std::unique_ptr<Entity>>* batch);
+
+    template<typename TPtr>
+    void destroy_batch(std::vector<TPtr>* batch)
+    {
+        batch->clear();
+    }
+
+
+    /** Killed objects are kept alive for frame_delay frames so pointers to them stay valid a while.
+     * A killed object is pushed into the bucket for frame N + frame_delay and advancing to that frame destroys the bucket in bulk,
+     * so the cost is per killed object instead of a scan of all living objects every frame.
+    */
+    template<typename TPtr>
+    struct ReclaimRing
+    {
+        static constexpr std::size_t frame_delay = 10;
+
+        /// takes ownership and kills the object
+        void retire(TPtr object);
+
+        /// destroy the objects that were retired frame_delay frames ago, call once per frame
+        void advance_frame();
+
+        std::size_t get_pending_count() const;
+
+    private:
+        std::array<std::vector<TPtr>, frame_delay + 1> buckets;
+        std::size_t frame = 0;
+    };
+
+    template<typename TPtr>
+    void ReclaimRing<TPtr>::retire(TPtr object)
+    {
+        assert(object != nullptr);
+        object->alive.kill();
+        buckets[(frame + frame_delay) % buckets.size()].emplace_back(std::move(object));
+    }
+
+    template<typename TPtr>
+    void ReclaimRing<TPtr>::advance_frame()
+    {
+        frame += 1;
+
+        // the bucket keeps the capacity so there is no allocation once the ring has warmed up
+        auto& bucket = buckets[frame % buckets.size()];
+        if(bucket.empty() == false)
+        {
+            destroy_batch(&bucket);
+        }
+    }
+
+    template<typename TPtr>
+    std::size_t ReclaimRing<TPtr>::get_pending_count() const
+    {
+        std::size_t count = 0;
+        for(const auto& bucket: buckets)
+        {
+            count += bucket.size();
+        }
+        return count;
+    }
+
+
+    struct EntitySystemWithPrio
+    {
+        EntitySystemWithPrio(EntitySystem* s, int p);
+
+        EntitySystem* system;
+        int prio;
+    };
+
+    struct EntitySystemUpdateStageList
+    {
+        void update(UpdateStage stage, float dt);
+        void add(EntitySystem* sys, int prio);
+        void remove(EntitySystem* sys);
+
+        /// sorted on prio
+        const std::vector<EntitySystemWithPrio>& get_systems() const { return systems; }
+
+    private:
+        std::vector<EntitySystemWithPrio> systems;
+        // can't iterate a std::priority_queue so let's not use that for now
+    };
+
+    /** Updates EntitySystem in the right order.
+    */
+    struct EntitySystemUpdate
+    {
+        std::array<EntitySystemUpdateStageList, UpdateStageCount> systems;
+
+        void update(UpdateStage stage, float dt);
+        void add(EntitySystem* sys, UpdateStage stage, int prio);
+        void remove(EntitySystem* sys, UpdateStage stage);
+    };
+
+
+    /**
+     * A generic thing that you can't derive from.
+     * @todo flesh out documentation
+    */
+    struct Entity
+    {
+        Entity();
+        ~Entity();
+
+        Entity(const Entity&) = delete;
+        void operator=(const Entity&) = delete;
+
+        /// use this instead of a Entity* when storing a reference to a entity
+        EntityHandle handle;
+
+        core::Guid guid;
+        std::vector<ComponentPtr> components;
+
+        /// the local systems, created from a EntitySystemType
+        std::vector<EntitySystemPtr> local_systems;
+        EntitySystemUpdate systems;
+
+        /// where the components live when the entity is backed by a ArchetypeStorage instead of components
+        Archetype* archetype = nullptr;
+        std::size_t archetype_chunk = 0;
+        std::size_t archetype_row = 0;
+
+        // dynamically add/remove components
+
+        SpatialComponent* root_component = nullptr;
+        bool is_spatial_entity() const { return root_component != nullptr; }
+
+        EntityState state = EntityState::unloaded;
+
+        /** Turn the enity on in the world.
+         * * register entity for all systems
+         * * create update list
+         * * create entity attachment
+         * 
+         * activate components/local systems paralellized with one enity per thread
+         * activate world systems with one system per thread
+         * 
+         * The global registrations are recorded to the commands and played back on the main thread,
+         * activation_order is used to sort them so the playback order doesn't depend on the threads.
+        */ 
+        void activate(std::size_t activation_order, ActivationCommands* global_commands);
+
+        /// Turn the entity off, remove entity from all local systems, the world removes it from the world systems
+        void deactivate();
+
+        /// update all systems
+        void update(UpdateStage stage, float dt);
+
+        /// position in the world update, set by World (spatial root handle index and depth)
+        std::uint64_t update_key = 0;
+
+        /** When automatic the tier is picked from the distance to the world points of interest, otherwise tier is used.
+         * Attached entities always use the tier of their spatial root.
+        */
+        UpdateTier tier = UpdateTier::every_frame;
+        bool automatic_tier = true;
+
+        /// the slot the entity is updated in and the slot it's moving to, set by World
+        std::uint8_t update_slot = 0;
+        std::uint8_t target_update_slot = 0;
+
+        /// index in the active entities of the World, set by World
+        std::size_t world_index = 0;
+
+        /// Load all components (resource, memory...), the resource requests are loaded on the io queue or directly if it's null
+        void load(core::TaskQueue* io);
+
+        /// Move components that have finished loading to loaded or load_failed, returns true when no component is loading
+        bool update_loading();
+
+        /// Initialize all loaded components, entities can be initialized in parallel
+        void initialize();
+
+        /// Unload all components (resource, memory...)
+        void unload();
+
+        Alive alive;
+    };
+
+    void attach(World* world, EntityHandle parent_id, EntityHandle child_id);
+
+
+    /** Basic data storage.
+     * 
+     * Properties that define settings and resource.
+     * 
+     * * Components have no access to other components.
+     * * Components have no access to the entity.
+     * * Components have no default update.
+     * * Inheritance of components is allowed.
+     * * Can contain logic if needed (example: animation graph component contains everything related to the animation graph) and be viewed as a black box.
+     *
+     * Loading state switching between @ref ComponentState
+        ```graphviz
+        digraph G
+        {
+            unloaded -> loading [label="load()"];
+            loading -> unloaded [label="unload()"];
+
+            loading_failed -> unloaded [label="unload()"];
+            loaded -> unloaded [label="unload()"];
+
+            loading -> loading_failed;
+            loading -> loaded;
+
+            loaded -> initialized[label="initialize()"];
+            initialized -> loaded[label="shutdown()"];
+        }
+        ```
+    */
+    struct Component
+    {
+        Component();
+
+        /// the copy gets a new handle
+        Component(const Component& other);
+        Component& operator=(const Component& other);
+
+        virtual ~Component();
+
+        /// use this instead of a Component* when storing a reference to a component
+        ComponentHandle handle;
+
+        core::Guid guid;
+
+        /// for debug and tools
+        std::string name;
+
+        /// set by the ComponentType that created this
+        const ComponentType* type = nullptr;
+
+        Alive alive;
+
+        ComponentState state = ComponentState::unloaded;
+
+        /// resource requests from on_load that haven't completed, changed from the io threads
+        std::atomic<int> pending_resources = 0;
+        std::atomic<bool> resources_failed = false;
+
+        // settings that are serialized
+        // resources that are loaded
+
+        virtual void on_load(ResourceRequests* requests); virtual void on_unload();
+        virtual void on_initialize(); virtual void on_shutdown();
+
+        /// save the runtime state for a world snapshot
+        virtual void save(SnapshotWriter* writer) const;
+
+        /// restore the runtime state, schema_version is ComponentType::schema_version when the snapshot was saved
+        virtual bool load(SnapshotReader* reader, std::uint32_t schema_version);
+    };
+
+    /** Registrations with WorldSystem recorded when entities are activated in parallel.
+     * There is one per thread, they are merged and played back on the main thread.
+    */
+    struct ActivationCommands
+    {
+        struct ComponentAdded
+        {
+            std::size_t activation_order;
+            std::size_t component_index;
+            Entity* entity;
+            Component* component;
+        };
+
+        std::vector<ComponentAdded> added;
+    };
+
+    /** Binary state of a World.
+     * 
+     * ```
+     * header:  magic, format version, type table offset, entity count
+     * entity:  handle, parent handle, component count, [type index, size in bytes, data] * component count
+     * types:   type count, [name hash, schema version] * type count
+     * ```
+     * All values are in the byte order of the machine that saved it and unaligned,
+     * the data is only valid for the build that saved it and isn't meant to be sent between machines.
+    */
+    struct Snapshot
+    {
+        static constexpr std::uint32_t magic = 0x504e534b; // "KSNP"
+        static constexpr std::uint32_t format_version = 2;
+
+        std::vector<unsigned char> data;
+    };
+
+    /// Appends to a Snapshot, the buffer keeps the capacity between saves.
+    struct SnapshotWriter
+    {
+        explicit SnapshotWriter(Snapshot* s);
+
+        template<typename T>
+        void write(const T& value)
+        {
+            static_assert(std::is_trivially_copyable_v<T>, "only trivially copyable types can be written directly");
+            write_bytes(&value, sizeof(T));
+        }
+
+        void write_bytes(const void* source, std::size_t size);
+
+        /// reserve space for a value that is written later with patch()
+        std::size_t reserve(std::size_t size);
+        void patch(std::size_t offset, const void* source, std::size_t size);
+
+        std::size_t get_size() const;
+
+    private:
+        Snapshot* snapshot;
+    };
+
+    /// Reads from a Snapshot without copying the buffer.
+    struct SnapshotReader
+    {
+        SnapshotReader(const unsigned char* d, std::size_t s);
+
+        template<typename T>
+        bool read(T* value)
+        {
+            static_assert(std::is_trivially_copyable_v<T>, "only trivially copyable types can be read directly");
+            const unsigned char* source = read_view(sizeof(T));
+            if(source == nullptr) { return false; }
+            std::memcpy(value, source, sizeof(T));
+            return true;
+        }
+
+        /// pointer into the snapshot and advance, null if there isn't enough data left
+        const unsigned char* read_view(std::size_t size);
+
+        bool skip(std::size_t size) { return read_view(size) != nullptr; }
+        std::size_t get_offset() const { return offset; }
+        bool is_at_end() const { return offset == size; }
+
+    private:
+        const unsigned char* data;
+        std::size_t size;
+        std::size_t offset = 0;
+    };
+
+    /** Resources a Component wants loaded, filled in Component::on_load.
+     * The component is loaded when all requests have completed.
+    */
+    struct ResourceRequests
+    {
+        /// called on a io thread, return false if the resource failed to load
+        using Load = std::function<bool ()>;
+
+        void request(Load load);
+
+        std::vector<Load> loads;
+    };
+
+    core::HandleTable<Entity>& entity_handles();
+    core::HandleTable<Component>& component_handles();
+
+    /// null if the entity has been destroyed, a destroyed entity stops resolving right away even if the ReclaimRing still holds it
+    Entity* resolve(EntityHandle handle);
+
+    /// null if the component, or the entity that owns it, has been destroyed
+    Component* resolve(ComponentHandle handle);
+
+
+    struct ComponentType
+    {
+        constexpr ComponentType(core::HashedStringView n, bool one_per_entity = true, std::size_t s = 0, std::size_t a = 0, std::uint32_t version = 1)
+            : name(n)
+            , max_one_per_entity(one_per_entity)
+            , size(s)
+            , alignment(a)
+            , schema_version(version)
+        {
+        }
+
+        core::HashedStringView name;
+        
+        /// can the enttity have many components of this type
+        bool max_one_per_entity;
+
+        /// sizeof and alignof the concrete component, needed to store the component in a ArchetypeChunk
+        std::size_t size;
+        std::size_t alignment;
+
+        /// increase when the snapshot data changes, old snapshots pass the old version to Component::load
+        std::uint32_t schema_version;
+
+        /// create the component from the pool of this type
+        virtual ComponentPtr create() const = 0;
+
+        /// destroy components created by create() and return the memory to the pool
+        virtual void destroy(Component* const* components, std::size_t count) const = 0;
+
+        virtual core::ObjectPool::Stats get_allocation_stats() const = 0;
+
+        /// create the component in memory that is owned by someone else
+        virtual Component* create_at(void* memory) const = 0;
+
+        /// move construct the component to memory and destroy the source
+        virtual Component* relocate(Component* source, void* memory) const = 0;
+    };
+
+    /// ComponentType for a concrete component
+    template<typename T>
+    struct ComponentTypeOf : ComponentType
+    {
+        explicit ComponentTypeOf(core::HashedStringView n, bool one_per_entity = true, std::uint32_t version = 1)
+            : ComponentType(n, one_per_entity, sizeof(T), alignof(T), version)
+            , pool(sizeof(T), alignof(T))
+        {
+        }
+
+        ComponentPtr create() const override
+        {
+            auto* c = new(pool.allocate()) T();
+            c->type = this;
+            return ComponentPtr{c};
+        }
+
+        void destroy(Component* const* components, std::size_t count) const override
+        {
+            static thread_local std::vector<void*> memory;
+            memory.clear();
+            for(std::size_t index=0; index<count; index+=1)
+            {
+                assert(components[index]->type == this);
+                T* c = static_cast<T*>(components[index]);
+                c->~T();
+                memory.emplace_back(c);
+            }
+            pool.free_batch(memory.data(), memory.size());
+        }
+
+        core::ObjectPool::Stats get_allocation_stats() const override
+        {
+            return pool.get_stats();
+        }
+
+        Component* create_at(void* memory) const override
+        {
+            auto* c = new(memory) T();
+            c->type = this;
+            return c;
+        }
+
+        Component* relocate(Component* source, void* memory) const override
+        {
+            T* src = static_cast<T*>(source);
+            auto* c = new(memory) T(std::move(*src));
+
+            // keep the handle when moving
+            std::swap(c->handle, src->handle);
+            component_handles().replace(c->handle, c);
+            component_handles().replace(src->handle, src);
+
+            src->~T();
+            return c;
+        }
+
+    private:
+        mutable core::ObjectPool pool;
+    };
+
+    /** Creates a new componet type for built-in components.
+     * 
+     * ```
+     * CUSTOM_COMPONENT(CustomComponent, custom, "custom-name");
+     * ```
+    */
+    #define CUSTOM_COMPONENT(TYPE, NAME, HASH)\
+    struct TYPE : ComponentType\
+    {\
+        constexpr TYPE() : ComponentType{HASH} {}\
+        ComponentPtr create() const override;\
+        void destroy(Component* const* components, std::size_t count) const override;\
+        core::ObjectPool::Stats get_allocation_stats() const override;\
+        Component* create_at(void* memory) const override;\
+        Component* relocate(Component* source, void* memory) const override;\
+    };\
+    constexpr TYPE NAME;\
+    static_assert(NAME.name.hash == core::hash_fnv1a(HASH), "name should be hashed at compile time");
+
+    /** Helpful factory to create Component.
+    */
+    struct ComponentFactory
+    {
+        void add(const ComponentType* name);
+        const ComponentType* from_name_or_null(core::HashedStringView name) const;
+    private:
+        core::HashTable<const ComponentType*> types;
+    };
+
+
+    /// Typed view of a column in a ArchetypeChunk.
+    template<typename T>
+    struct ColumnSpan
+    {
+        T* data;
+        std::size_t size;
+
+        T* begin() const { return data; }
+        T* end() const { return data + size; }
+        T& operator[](std::size_t index) const { assert(index < size); return data[index]; }
+    };
+
+    /// Fixed size memory block, the columns are placed by the owning Archetype.
+    struct ArchetypeChunk
+    {
+        /// the whole chunk, header included
+        static constexpr std::size_t size_in_bytes = 16 * 1024;
+        static constexpr std::size_t max_alignment = 64;
+
+        /// count is padded to max_alignment so memory stays aligned
+        static constexpr std::size_t memory_size = size_in_bytes - max_alignment;
+
+        /// number of used rows
+        std::size_t count = 0;
+
+        alignas(max_alignment) unsigned char memory[memory_size];
+    };
+    static_assert(sizeof(ArchetypeChunk) == ArchetypeChunk::size_in_bytes);
+
+    /** All entities with the same set of component types.
+     * Each chunk has a Entity* column and one column per component type, sorted on the type address.
+    */
+    struct Archetype
+    {
+        explicit Archetype(std::vector<const ComponentType*> sorted_types);
+
+        std::vector<const ComponentType*> types;
+
+        /// byte offset into the chunk for each column, same order as types
+        std::vector<std::size_t> column_offsets;
+
+        /// number of rows that fit in a chunk
+        std::size_t rows_per_chunk;
+
+        std::vector<std::unique_ptr<ArchetypeChunk>> chunks;
+
+        /// index into types or -1 if the archetype doesn't have the type
+        int index_of(const ComponentType* type) const;
+
+        Entity** get_entities(ArchetypeChunk* chunk) const;
+        Component* get_component(ArchetypeChunk* chunk, std::size_t column, std::size_t row) const;
+    };
+
+    /** Alternative backing for components.
+     * Instead of one heap allocation per component, entities with the same component types share a Archetype and the
+     * components are stored column by column in 16 KB chunks.
+     * 
+     * Components are moved when other entities are removed so don't store Component* to a archetype backed component.
+     * @todo add/remove single components (move entity between archetypes)
+    */
+    struct ArchetypeStorage
+    {
+        ArchetypeStorage() = default;
+        ~ArchetypeStorage();
+
+        ArchetypeStorage(const ArchetypeStorage&) = delete;
+        void operator=(const ArchetypeStorage&) = delete;
+
+        /// create the components for the entity, the entity must not already be backed by a archetype
+        void add(Entity* entity, std::vector<const ComponentType*> types);
+
+        /// destroy the components for the entity
+        void remove(Entity* entity);
+
+        /// null if the entity doesn't have the component
+        Component* get(const Entity& entity, const ComponentType* type) const;
+
+        /** Call fun(ColumnSpan<T>...) for each chunk whose archetype has all types.
+         * 
+         * ```
+         * storage.for_each_chunk<Position, Velocity>({&position_type, &velocity_type}, [](ColumnSpan<Position> p, ColumnSpan<Velocity> v) {});
+         * ```
+        */
+        template<typename... T, typename F>
+        void for_each_chunk(const std::array<const ComponentType*, sizeof...(T)>& types, F&& fun);
+
+    private:
+        Archetype* get_or_create(std::vector<const ComponentType*> sorted_types);
+
+        std::vector<std::unique_ptr<Archetype>> archetypes;
+    };
+
+    template<typename... T, typename F>
+    void ArchetypeStorage::for_each_chunk(const std::array<const ComponentType*, sizeof...(T)>& types, F&& fun)
+    {
+        constexpr std::size_t type_count = sizeof...(T);
+#ifndef NDEBUG
+        constexpr std::array<std::size_t, type_count> sizes = {sizeof(T)...};
+        for(std::size_t index=0; index<type_count; index+=1)
+        {
+            assert(types[index]->size == sizes[index] && "component type doesn't match the c++ type");
+        }
+#endif
+
+        for(auto& archetype: archetypes)
+        {
+            std::array<std::size_t, type_count> offsets;
+            bool has_all = true;
+            for(std::size_t index=0; index<type_count; index+=1)
+            {
+                const int column = archetype->index_of(types[index]);
+                if(column < 0) { has_all = false; break; }
+                offsets[index] = archetype->column_offsets[static_cast<std::size_t>(column)];
+            }
+            if(has_all == false) { continue; }
+
+            for(auto& chunk: archetype->chunks)
+            {
+                if(chunk->count == 0) { continue; }
+                std::size_t column = 0;
+                // braced init to get a left to right evaluation order
+                std::apply(fun, std::tuple<ColumnSpan<T>...>
+                {
+                    ColumnSpan<T>{reinterpret_cast<T*>(chunk->memory + offsets[column++]), chunk->count}...
+                });
+            }
+        }
+    }
+
+
+    /**
+     * This is the only components that can reference other components.
+     * All components in graph must belong to the same entity (so same thread), with the exception of spatial entities that are attached to other spatial entitites.
+     * It's still safe since it's hidden from the user and sheduling ensures it's updated in order and on the same thread.
+    */
+    struct SpatialComponent : Component
+    {
+    private:
+        core::mat4f _local_transform;
+        core::mat4f _global_transform;
+
+    public:
+        /// with deferred transforms the world transform isn't updated until the end of the stage
+        void set_local_transform(const core::mat4f& m);
+        void set_local_bounds(const core::Obb& bounds);
+
+        /// the entity this is attached to or a invalid handle if this is a root
+        EntityHandle get_parent() const { return parent; }
+        
+
+        const core::mat4f& get_local_transform() { return _local_transform; };
+        const core::mat4f& get_global_transform();
+        const core::Obb& get_world_bounds();
+
+        /// recursive update of this and all children, with deferred transforms this only marks the transform as dirty
+        void update_world_transform();
+
+        void save(SnapshotWriter* writer) const override;
+        bool load(SnapshotReader* reader, std::uint32_t schema_version) override;
+
+    private:
+        friend struct TransformHierarchy;
+        friend struct SpatialIndex;
+
+        /// tell the spatial index that the world bounds has changed
+        void mark_moved();
+
+        /// set when the world uses deferred transforms
+        TransformHierarchy* hierarchy = nullptr;
+        std::uint32_t hierarchy_node = 0;
+
+        /// set while the entity is active
+        SpatialIndex* spatial_index = nullptr;
+        std::uint32_t spatial_slot = 0;
+
+        /// non-inclusive bounds in local space
+        core::Obb local_bounds;
+
+        /// non-inclusive bounds in world space
+        core::Obb world_bounds;
+
+        // parent spatial components + socket attachment
+        EntityHandle parent;
+
+        /// can reference other spatial components: https://youtu.be/jjEsB611kxs?t=6639
+        /// @todo find out if this can reference entities in other components or not
+        std::vector<ComponentHandle> children;
+
+        friend void attach(World* world, EntityHandle parent_id, EntityHandle child_id);
+        friend struct World;
+    };
+
+    extern const ComponentTypeOf<SpatialComponent> spatial_component_type;
+
+    /** All root spatial components in a world stored in flat arrays in parent before child order.
+     * Setting a local transform only marks the node as dirty, global transforms and world bounds
+     * are calculated for all dirty nodes in a single linear pass with update().
+    */
+    struct TransformHierarchy
+    {
+        /// take over the spatial components, update_order must be sorted parent before child
+        void rebuild(const std::vector<Entity*>& update_order);
+
+        /// copy the transforms back to the components and release them
+        void clear();
+
+        void set_local_transform(std::uint32_t node, const core::mat4f& m);
+        void set_local_bounds(std::uint32_t node, const core::Obb& bounds);
+        void mark_dirty(std::uint32_t node);
+
+        bool is_dirty() const { return any_dirty.load(std::memory_order_relaxed); }
+
+        /// recalculate global transforms and world bounds for all dirty nodes and their children
+        void update();
+
+        // one entry per node
+        std::vector<std::int32_t> parents; // -1 for roots, always less than the node index
+        std::vector<core::mat4f> local_transforms;
+        std::vector<core::mat4f> global_transforms;
+        std::vector<core::Obb> local_bounds;
+        std::vector<core::Obb> world_bounds;
+        std::vector<std::uint8_t> dirty;
+        std::vector<SpatialComponent*> components;
+
+    private:
+        /// set from worker threads, each node is only written by the thread that owns the entity
+        std::atomic<bool> any_dirty = false;
+    };
+
+
+    /** The world bounds of all active spatial entities in a DynamicBvh.
+     * Spatial components mark themselves as moved when their world bounds change (one byte per entity so it's safe from any thread)
+     * and the world refits the moved entities once per stage after the deferred transforms has been updated.
+     * The tree is only modified between stages so queries can be made by any system.
+     * Queries test the axis aligned box of the world bounds so they can report entities slightly outside the shape.
+    */
+    struct SpatialIndex
+    {
+        SpatialIndex();
+
+        void add(Entity* entity);
+        void remove(Entity* entity);
+
+        void mark_moved(std::uint32_t slot);
+
+        /// refit the entities that has moved since the last update
+        void update();
+
+        std::size_t get_size() const { return bvh.get_proxy_count(); }
+
+        /// the results are appended
+        void query(const core::Frustum& frustum, std::vector<EntityHandle>* result) const;
+        void query(const core::Sphere& sphere, std::vector<EntityHandle>* result) const;
+        void query(const core::Ray& ray, std::vector<EntityHandle>* result) const;
+
+        /** Run several queries, results[i] is replaced with the hits for shapes[i].
+         * Queries are split over the workers, null workers runs them on the calling thread.
+         * Since WorkerPool::run isn't reentrant this can't use the world workers from a entity system.
+        */
+        void query_batch(const core::Frustum* shapes, std::size_t count, std::vector<EntityHandle>* results, core::WorkerPool* workers) const;
+        void query_batch(const core::Sphere* shapes, std::size_t count, std::vector<EntityHandle>* results, core::WorkerPool* workers) const;
+        void query_batch(const core::Ray* shapes, std::size_t count, std::vector<EntityHandle>* results, core::WorkerPool* workers) const;
+
+    private:
+        template<typename TShape>
+        void query_impl(const TShape& shape, std::vector<EntityHandle>* result) const;
+
+        template<typename TShape>
+        void query_batch_impl(const TShape* shapes, std::size_t count, std::vector<EntityHandle>* results, core::WorkerPool* workers) const;
+
+        core::DynamicBvh bvh;
+
+        // one entry per slot, slots of removed entities are reused
+        std::vector<SpatialComponent*> components;
+        std::vector<EntityHandle> entities;
+        std::vector<std::uint32_t> proxies;
+        std::vector<std::uint8_t> moved;
+        std::vector<std::uint32_t> free_slots;
+
+        std::atomic<bool> any_moved = false;
+    };
+
+
+    /** Required and optional components for EntitySystem and WorldSystem.
+    Contains requireed and optional components for a system to work.
+    With tooling a user can see if the added system is missing components.
+
+    Example: Character animation system requires Animation and Skeletal Mesh and has a optional Cloth.
+    */
+    struct RequestedComponents
+    {
+        std::vector<const ComponentType*> required;
+        std::vector<const ComponentType*> optional;
+    };
+
+    /** A local system for a entity.
+     * 
+     * only one system of a specified type is allowed per entity
+     * 
+     * * It's manually added to a entity
+     * * It can have entity specific data
+     * * It can't reference other entities
+     * 
+     * Examples
+     *  * animation (uses animation and mesh components)
+     *  * movement
+     *  * targeting
+     */
+    struct EntitySystem
+    {
+        virtual ~EntitySystem() = default;
+
+        /// set by the EntitySystemType that created this
+        const EntitySystemType* type = nullptr;
+
+        /// get requested components
+        /// @todo move to a entity sytem type
+        virtual RequestedComponents get_component_requests() = 0;
+
+        /*
+        design thought: who removes this from the update list when it's destroyed?
+        better to return a register request and let the caller add/remove stages+prios to the update list?
+        */
+        virtual void register_updates(EntitySystemUpdate* updates) = 0;
+
+        /// Called by EntitySystemUpdate, dt is the time since the last update of this entity (larger for lower UpdateTier)
+        virtual void update(UpdateStage stage, float dt) = 0;
+
+        /*
+        design thoughts:
+        should we get a callback for each component, or a general... here is a the latest state of the components you care about
+        current setup is probably easier to implement but requirements could be different from actual usage
+
+        keep in mind that the system is per entity so it's just getting references to components and storing them as member variables
+        */
+
+        /// a component was added or activated on the entity
+        virtual void component_was_added(Component* c) = 0;
+
+        /// a component was removed or deactivated on the entity
+        virtual void component_was_removed(Component* c) = 0;
+    };
+
+
+    struct EntitySystemType
+    {
+        core::HashedStringView name;
+
+        EntitySystemType(core::HashedStringView);
+        virtual ~EntitySystemType() = default;
+
+        /// create the system from the pool of this type
+        virtual EntitySystemPtr create() const = 0;
+
+        /// destroy a system created by create() and return the memory to the pool
+        virtual void destroy(EntitySystem* system) const = 0;
+
+        virtual core::ObjectPool::Stats get_allocation_stats() const = 0;
+
+        /// update many systems of this type with a single virtual call
+        virtual void update_all(EntitySystem* const* systems, std::size_t count, UpdateStage stage, float dt) const = 0;
+    };
+
+    /// EntitySystemType for a concrete system
+    template<typename T>
+    struct EntitySystemTypeOf : EntitySystemType
+    {
+        explicit EntitySystemTypeOf(core::HashedStringView n)
+            : EntitySystemType(n)
+            , pool(sizeof(T), alignof(T))
+        {
+        }
+
+        EntitySystemPtr create() const override
+        {
+            auto* s = new(pool.allocate()) T();
+            s->type = this;
+            return EntitySystemPtr{s};
+        }
+
+        void destroy(EntitySystem* system) const override
+        {
+            assert(system->type == this);
+            T* s = static_cast<T*>(system);
+            s->~T();
+            pool.free(s);
+        }
+
+        core::ObjectPool::Stats get_allocation_stats() const override
+        {
+            return pool.get_stats();
+        }
+
+        void update_all(EntitySystem* const* systems, std::size_t count, UpdateStage stage, float dt) const override
+        {
+            for(std::size_t index=0; index<count; index+=1)
+            {
+                // qualified call to skip the virtual dispatch
+                static_cast<T*>(systems[index])->T::update(stage, dt);
+            }
+        }
+
+    private:
+        mutable core::ObjectPool pool;
+    };
+
+    struct EntitySystemFactory
+    {
+        void add(const EntitySystemType* ny);
+        const EntitySystemType* from_name_or_null(core::HashedStringView name) const;
+
+    private:
+        core::HashTable<const EntitySystemType*> types;
+    };
+
+
+    /*
+    Design thoughts: should we have a single instance or a per-entity instance.
+    Currently it's written as a per-entity instance.
+
+    Pro:
+    * Simpler
+    * We can be sure it's thread safe as it won't integrate with other streads
+
+    Cons:
+    * Ugly
+    * Wastes memory as we need a instance of the system per entity
+
+
+    */
+
+    /** A global system for the world.
      * 
-     * Examples
-     *  * animation (uses animation and mesh components)
-     *  * movement
-     *  * targeting
-     */
-    struct EntitySystem
+     * Only one system of a specified type is allowed per world
+     * 
+     * Primary role is to handle global world state.
+     * Secondary role is to do data transfer between entitites.
+     * 
+     * 
+     * Examples:
+     *  * skeletal mesh
+     *  * physics
+     *  * static mesh
+     *  * navmesh
+     * 
+     * @todo Add types similar to ComponentType and ComponentFactory
+    */
+    struct WorldSystem
+    {
+        virtual ~WorldSystem() = default;
+
+        /// set by the WorldSystemType that created this, may be null
+        const WorldSystemType* type = nullptr;
+
+        virtual void register_updates(WorldSystemUpdate* updates) = 0;
+
+        /*
+        Design thought: if this is used to transfer data between components,
+        should there be some ui hint system similar to get_component_requests?
+        */
+
+        /// Called by WorldSystemUpdate
+        virtual void update(UpdateStage stage) = 0;
+
+        virtual void system_was_added_to_world() = 0;
+        virtual void system_was_removed_from_world() = 0;
+
+        /// a component was added or activated on a entity
+        virtual void component_was_added(Entity* ent, Component* c) = 0;
+
+        /// a component was removed or deactivated on a entity
+        virtual void component_was_removed(Entity* ent, Component* c) = 0;
+    };
+
+    struct WorldSystemType
+    {
+        core::HashedStringView name;
+
+        WorldSystemType(core::HashedStringView);
+        virtual ~WorldSystemType() = default;
+
+        virtual std::unique_ptr<WorldSystem> create() = 0;
+    };
+
+    struct WorldSystemFactory
+    {
+        void add(const WorldSystemType* ty);
+        const WorldSystemType* from_name_or_null(core::HashedStringView name) const;
+
+    private:
+        core::HashTable<const WorldSystemType*> types;
+    };
+
+    struct WorldSystemWithPrio
+    {
+        WorldSystemWithPrio(WorldSystem* s, int p);
+
+        WorldSystem* system;
+        int prio;
+    };
+
+    struct WorldSystemUpdateStageList
+    {
+        void update(UpdateStage stage);
+        void add(WorldSystem* sys, int prio);
+        void remove(WorldSystem* sys);
+
+    private:
+        std::vector<WorldSystemWithPrio> systems;
+    };
+
+    /** Updates WorldSystem.
+    */
+    struct WorldSystemUpdate
+    {
+        void update(UpdateStage);
+
+        void add(WorldSystem*, UpdateStage, int prio);
+        void remove(WorldSystem*, UpdateStage stage);
+
+    private:
+        std::array<WorldSystemUpdateStageList, UpdateStageCount> systems;
+    };
+
+    /** Structural changes recorded during a stage and played back by the world when the stage is done.
+     * 
+     * There is one per thread so recording doesn't need a lock, a system gets the buffer for the thread it's running on
+     * with WorldCommands::get_current(). Commands are played back per thread in the order they were recorded,
+     * so commands recorded on different threads shouldn't depend on each other.
+    */
+    struct WorldCommands
+    {
+        /// the entity is loaded and activated on playback, the handle is valid directly
+        EntityHandle spawn(std::unique_ptr<Entity> entity);
+
+        /// deactivate and remove from the world, the memory is released a few frames later
+        void destroy(EntityHandle entity);
+
+        /// the component is loaded and initialized on playback if the entity is active
+        void add_component(EntityHandle entity, ComponentPtr component);
+        void remove_component(EntityHandle entity, ComponentHandle component);
+
+        void attach(EntityHandle parent, EntityHandle child);
+
+        bool is_empty() const { return commands.empty(); }
+
+        /// the buffer for the current thread while a world is updating, null otherwise
+        static WorldCommands* get_current();
+
+        /// set the current buffer for the lifetime of the scope
+        struct Scope
+        {
+            explicit Scope(WorldCommands* commands);
+            ~Scope();
+
+            Scope(const Scope&) = delete;
+            void operator=(const Scope&) = delete;
+
+            WorldCommands* previous;
+        };
+
+    private:
+        friend struct World;
+
+        enum class Type { spawn, destroy, add_component, remove_component, attach };
+
+        struct Command
+        {
+            Type type;
+            EntityHandle entity;
+            EntityHandle other_entity;
+            ComponentHandle component_handle;
+            std::unique_ptr<Entity> new_entity;
+            ComponentPtr new_component;
+        };
+
+        std::vector<Command> commands;
+    };
+
+    /** The entity systems of all active entities, for each stage grouped by prio, chain depth, rank and concrete EntitySystemType.
+     * Instead of updating entity by entity each group is one type-homogeneous loop with a single virtual call per batch.
+     * 
+     * The groups are updated one after the other. Depth (from Entity::update_key) is before the type so all systems of a parent
+     * are updated before the systems with the same prio of its children. Rank is the index among the systems with the same prio
+     * in a entity so the systems of a entity are still updated in the order they were registered.
+     * The plan is rebuilt in one pass from the world update order when something has changed.
+    */
+    struct EntityUpdatePlan
+    {
+        /// rebuild all groups from the entities in the update order (parent before child)
+        void rebuild(const std::vector<Entity*>& update_order);
+
+        /// advance the frame and calculate the dt for the slots that are updated this frame
+        void begin_frame(float dt);
+
+        std::uint64_t get_frame() const { return frame; }
+
+        /// true if the slot is updated this frame
+        bool is_due(std::uint8_t slot) const;
+
+        /// time that has passed since the slot was last updated, given to the systems in the slot on the next update
+        double get_pending_time(std::uint8_t slot) const { return time - slot_time[slot]; }
+
+        /// commands_per_thread is made current while updating, indexed with WorkerPool::get_thread_index()
+        void update(UpdateStage stage, core::WorkerPool* workers, WorldCommands* commands_per_thread);
+
+    private:
+        struct Slot
+        {
+            /// in update order
+            std::vector<EntitySystem*> systems;
+
+            /// [begin, end) into systems
+            std::vector<std::pair<std::size_t, std::size_t>> batches;
+        };
+
+        struct Batch
+        {
+            const Slot* slot;
+            std::size_t begin;
+            std::size_t end;
+            float dt;
+        };
+
+        struct Group
+        {
+            int prio;
+            std::uint32_t depth;
+            std::uint32_t rank;
+            const EntitySystemType* type;
+            std::array<Slot, UpdateSlotCount> slots;
+
+            /// the batches of the slots that are due this frame
+            std::vector<Batch> due_batches;
+        };
+
+        Group* get_or_create_group(UpdateStage stage, int prio, std::uint32_t depth, std::uint32_t rank, const EntitySystemType* type);
+        static void build_batches(Slot* slot);
+
+        std::array<std::vector<Group>, UpdateStageCount> stages;
+
+        std::uint64_t frame = 0;
+        double time = 0.0;
+
+        /// the time each slot was last updated and the time since that
+        std::array<double, UpdateSlotCount> slot_time = {};
+        std::array<float, UpdateSlotCount> slot_dt = {};
+    };
+
+    /// component types a Query needs, the entity is only matched if it has all of them
+    template<typename... T> struct Required {};
+
+    /// component types a Query can use, null when the entity doesn't have it
+    template<typename... T> struct Optional {};
+
+    /** Cached set of the active entities that have all required components, kept up to date by the World
+     * as entities and components are added and removed so systems doesn't need to keep their own lists.
+     * 
+     * Each match is a row in a single contiguous array (entity then one pointer per component type) so iterating is linear.
+     * Only initialized components are matched. Components are only killed when the World retires them, from
+     * WorldCommands::remove_component or when the entity is destroyed, and both remove the match before that.
+    */
+    struct QueryCache
+    {
+        QueryCache(std::vector<const ComponentType*> required_types, std::vector<const ComponentType*> optional_types);
+
+        std::vector<const ComponentType*> required;
+        std::vector<const ComponentType*> optional;
+
+        std::size_t size() const { return entities.size(); }
+
+        /// add, update or remove the entity depending on if it matches
+        void update_entity(Entity* entity);
+        void remove_entity(const Entity* entity);
+
+        /// number of pointers per row, required then optional
+        std::size_t column_count;
+
+        // one row per match
+        std::vector<Entity*> entities;
+        std::vector<Component*> components;
+        std::unordered_map<const Entity*, std::size_t> row_of;
+    };
+
+    template<typename TRequired, typename TOptional = Optional<>>
+    struct Query;
+
+    /** Typed view of a QueryCache, get it with World::query and iterate with for_each.
+     * ```
+     * world.query<Required<Position, Velocity>, Optional<Health>>({&position_type, &velocity_type}, {&health_type})
+     *     .for_each([](Entity& ent, Position& p, Velocity& v, Health* h) {});
+     * ```
+    */
+    template<typename... R, typename... O>
+    struct Query<Required<R...>, Optional<O...>>
+    {
+        using RequiredTypes = std::array<const ComponentType*, sizeof...(R)>;
+        using OptionalTypes = std::array<const ComponentType*, sizeof...(O)>;
+
+        explicit Query(const QueryCache* c);
+
+        std::size_t size() const { return cache->size(); }
+
+        /// fun(Entity&, R&..., O*...) for each match
+        template<typename F>
+        void for_each(F&& fun) const;
+
+        /// the matches are split in chunks of chunk_size rows and each chunk is a job, fun must be safe to call from several threads
+        template<typename F>
+        void for_each_parallel(core::WorkerPool* workers, std::size_t chunk_size, F&& fun) const;
+
+    private:
+        template<typename F, std::size_t... I>
+        void for_each_row(std::size_t begin, std::size_t end, F& fun, std::index_sequence<I...>) const;
+
+        template<std::size_t I>
+        static decltype(auto) get_column(Component* const* row);
+
+        const QueryCache* cache;
+    };
+
+    template<typename... R, typename... O>
+    Query<Required<R...>, Optional<O...>>::Query(const QueryCache* c)
+        : cache(c)
+    {
+        constexpr std::array<std::size_t, sizeof...(R) + sizeof...(O)> sizes = {sizeof(R)..., sizeof(O)...};
+        assert(cache->column_count == sizes.size());
+        for(std::size_t index=0; index<sizes.size(); index+=1)
+        {
+            [[maybe_unused]] const ComponentType* type = index < sizeof...(R) ? cache->required[index] : cache->optional[index - sizeof...(R)];
+            assert(type->size == sizes[index] && "component type doesn't match the c++ type");
+        }
+    }
+
+    template<typename... R, typename... O>
+    template<std::size_t I>
+    decltype(auto) Query<Required<R...>, Optional<O...>>::get_column(Component* const* row)
+    {
+        using T = std::tuple_element_t<I, std::tuple<R..., O...>>;
+        if constexpr (I < sizeof...(R)) { return static_cast<T&>(*row[I]); }
+        else { return static_cast<T*>(row[I]); }
+    }
+
+    template<typename... R, typename... O>
+    template<typename F, std::size_t... I>
+    void Query<Required<R...>, Optional<O...>>::for_each_row(std::size_t begin, std::size_t end, F& fun, std::index_sequence<I...>) const
+    {
+        for(std::size_t index=begin; index<end; index+=1)
+        {
+            [[maybe_unused]] Component* const* row = cache->components.data() + index * cache->column_count;
+            fun(*cache->entities[index], get_column<I>(row)...);
+        }
+    }
+
+    template<typename... R, typename... O>
+    template<typename F>
+    void Query<Required<R...>, Optional<O...>>::for_each(F&& fun) const
+    {
+        for_each_row(0, cache->size(), fun, std::index_sequence_for<R..., O...>{});
+    }
+
+    template<typename... R, typename... O>
+    template<typename F>
+    void Query<Required<R...>, Optional<O...>>::for_each_parallel(core::WorkerPool* workers, std::size_t chunk_size, F&& fun) const
+    {
+        assert(chunk_size > 0);
+        const std::size_t count = cache->size();
+        const std::size_t chunk_count = (count + chunk_size - 1) / chunk_size;
+        workers->run(chunk_count, [this, &fun, count, chunk_size](std::size_t chunk)
+        {
+            const std::size_t begin = chunk * chunk_size;
+            for_each_row(begin, std::min(begin + chunk_size, count), fun, std::index_sequence_for<R..., O...>{});
+        });
+    }
+
+    struct World
+    {
+        World();
+
+        /// takes ownership of the entity, a unloaded entity is loaded on the calling thread, and activates it
+        Entity* add(std::unique_ptr<Entity> entity);
+
+        /// register the system, all active components are reported with component_was_added
+        void add_system(std::unique_ptr<WorldSystem> system);
+
+        /** Takes ownership of a unloaded entity and starts to load it.
+         * When all components are loaded they are initialized and the entity is placed in the pending activation queue,
+         * the entity is activated and added to the world in the next start_frame.
+        */
+        void load(std::unique_ptr<Entity> entity);
+
+        /// number of entities that are loading or waiting to be activated
+        std::size_t get_loading_count() const;
+
+        /// time the entity hasn't been updated with yet since it's in a slot that isn't due every frame
+        double get_pending_time(const Entity* entity) const { return update_plan.get_pending_time(entity->update_slot); }
+
+        /// the active entities, destroying a entity moves the last entity to its place
+        const std::vector<std::unique_ptr<Entity>>& get_entities() const { return entities; }
+
+        /// dt is the time since the last frame, the same for all stages and only used in start_frame
+        void update(UpdateStage s, float dt);
+
+        /** Entities with a automatic tier update less often the further they are from the closest point of interest (camera, players...).
+         * Entities further than the distance update with the next lower tier, without any points all entities update every frame.
+        */
+        void set_points_of_interest(std::vector<core::vec3f> points);
+        void set_tier_distances(float every_2nd_frame, float every_4th_frame, float dormant);
+
+        /// defaults to number of cores - 1, the thread calling update() also updates entities
+        void set_worker_count(std::size_t count);
+
+        /** When enabled the global transforms are stored in a TransformHierarchy and updated at the end of each stage
+         * instead of each time a local transform is changed.
+        */
+        void set_deferred_transforms(bool deferred);
+
+        /// save the state of all active entities to a single buffer
+        void save_snapshot(Snapshot* snapshot) const;
+
+        /// the command buffer for the calling thread, played back after the current stage
+        WorldCommands& get_commands();
+
+        /// world bounds of all active spatial entities, refitted at the end of each stage
+        const SpatialIndex& get_spatial_index() const { return spatial_index; }
+
+        /** The active entities that have all the required components.
+         * The match set is created on the first call and kept up to date, the same types returns the same set.
+         * Only valid while no structural changes are made, that is during a stage.
+        */
+        template<typename TRequired, typename TOptional = Optional<>>
+        Query<TRequired, TOptional> query(const typename Query<TRequired, TOptional>::RequiredTypes& required, const typename Query<TRequired, TOptional>::OptionalTypes& optional = {})
+        {
+            return Query<TRequired, TOptional>{get_or_create_query(
+                {required.begin(), required.end()},
+                {optional.begin(), optional.end()}
+            )};
+        }
+
+        /// for parallel queries from world systems, entity systems are already running on the workers and can't use it
+        core::WorkerPool* get_workers() { return workers.get(); }
+
+        /** Restore a snapshot saved by this or another world (rollback or load).
+         * Entities that are still alive with the same components are loaded in place and keep their handles.
+         * Entities that have been destroyed since the snapshot, or that were saved by another world, are recreated
+         * with the component types looked up in the factory and get new handles.
+         * Entities that weren't in the snapshot are destroyed and the attachments are restored.
+         * Only the component state is saved, recreated entities have no local systems.
+         * Returns false if a component fails to load, if the snapshot is invalid or if a entity needs to be
+         * recreated and the factory is null or missing a type. No entities are added or removed then
+         * but the state of the entities may be partially restored.
+        */
+        bool restore_snapshot(const Snapshot& snapshot, const ComponentFactory* factory = nullptr);
+
+    private:
+        friend void attach(World* world, EntityHandle parent_id, EntityHandle child_id);
+
+        /// rebuild the update chains, only needed when a entity is added or (de)attached
+        void build_update_chains();
+
+        /// initialize loaded entities and activate the pending ones
+        void update_loading();
+
+        /// activate entities in parallel and register the components with the world systems
+        void activate(const std::vector<std::unique_ptr<Entity>>& to_activate);
+
+        /// apply the structural changes recorded during the stage
+        void play_back_commands();
+
+        QueryCache* get_or_create_query(std::vector<const ComponentType*> required, std::vector<const ComponentType*> optional);
+
+        /// pick the tier for each chain and move the chains that can change slot this frame
+        void update_tiers();
+        UpdateTier get_wanted_tier(const Entity* root) const;
+        std::uint8_t pick_target_slot(std::uint8_t current_slot, UpdateTier tier) const;
+
+        /// append a activated entity to entities
+        void add_active(std::unique_ptr<Entity> entity);
+
+        void destroy(Entity* entity);
+
+        /// the child becomes a root and the parent forgets about it, the global transform isn't updated
+        void detach(Entity* child);
+
+        void add_component(Entity* entity, ComponentPtr component);
+        void remove_component(Entity* entity, Component* component);
+
+        std::vector<std::unique_ptr<Entity>> entities;
+        std::vector<std::unique_ptr<WorldSystem>> systems;
+        WorldSystemUpdate system_update;
+
+        std::unique_ptr<core::WorkerPool> workers;
+
+        /** All entities sorted so that attached entities are after their spatial root, ordered by depth.
+         * A chain is all entities with the same root, the update plan groups the chains by depth.
+        */
+        std::vector<Entity*> update_order;
+        bool update_chains_dirty = true;
+
+        /// set when a entity has changed update slot, the plan is rebuilt before the next stage
+        bool update_plan_dirty = false;
+
+        bool deferred_transforms = false;
+        TransformHierarchy transforms;
+        SpatialIndex spatial_index;
+
+        EntityUpdatePlan update_plan;
+
+        std::vector<core::vec3f> points_of_interest;
+        std::array<float, 3> tier_distances = {50.0f, 100.0f, 200.0f};
+
+        /// number of entities moving to or in each slot, used to spread the slots evenly
+        std::array<std::size_t, UpdateSlotCount + 1> slot_load = {};
+
+        std::vector<std::unique_ptr<QueryCache>> queries;
+
+        /// entities that have started loading
+        std::vector<std::unique_ptr<Entity>> loading_entities;
+
+        /// loaded and initialized entities waiting to be activated
+        std::vector<std::unique_ptr<Entity>> pending_activation;
+
+        /// one per thread in the worker pool
+        std::vector<ActivationCommands> activation_commands;
+        std::vector<ActivationCommands::ComponentAdded> merged_activation_commands;
+
+        /// one per thread in the worker pool
+        std::vector<WorldCommands> commands;
+
+        /// destroyed entities and removed components waiting to be deleted
+        ReclaimRing<std::unique_ptr<Entity>> dead_entities;
+        ReclaimRing<ComponentPtr> dead_components;
+
+        /// destroyed before the entities that requests reference
+        core::TaskQueue io;
+    };
+
+
+
+
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // Implementations
+
+    void Alive::kill()
+    {
+        dead = true;
+    }
+
+    bool Alive::is_pending_removal() const
+    {
+        return dead;
+    }
+
+
+    // ------------------------------------------------------------------------
+    // EntitySystemWithPrio
+
+    EntitySystemWithPrio::EntitySystemWithPrio(EntitySystem* s, int p)
+        : system(s)
+        , prio(p)
+    {
+    }
+
+
+    // ------------------------------------------------------------------------
+    // EntitySystemUpdateStageList
+
+    void EntitySystemUpdateStageList::update(UpdateStage stage, float dt)
+    {
+        for(auto& es: systems)
+        {
+            es.system->update(stage, dt);
+        }
+    }
+
+    void EntitySystemUpdateStageList::add(EntitySystem* sys, int prio)
+    {
+        // insert after all with the same prio, list is always sorted
+        const auto where = std::upper_bound(systems.begin(), systems.end(), prio, [](int p, const EntitySystemWithPrio& es)
+        {
+            return p < es.prio;
+        });
+        systems.emplace(where, sys, prio);
+    }
+
+    void EntitySystemUpdateStageList::remove(EntitySystem* sys)
+    {
+        // keep the prio order
+        systems.erase(std::remove_if(systems.begin(), systems.end(),
+            [sys](const EntitySystemWithPrio& es)
+            { return es.system == sys;}
+        ), systems.end());
+    }
+
+
+    // ------------------------------------------------------------------------
+    // EntitySystemUpdate
+
+    void EntitySystemUpdate::update(UpdateStage stage, float dt)
+    {
+        systems[static_cast<std::size_t>(stage)].update(stage, dt);
+    }
+
+    void EntitySystemUpdate::add(EntitySystem* sys, UpdateStage stage, int prio)
+    {
+        systems[static_cast<std::size_t>(stage)].add(sys, prio);
+    }
+
+    void EntitySystemUpdate::remove(EntitySystem* sys, UpdateStage stage)
+    {
+        systems[static_cast<std::size_t>(stage)].remove(sys);
+    }
+
+
+    // ------------------------------------------------------------------------
+    // ComponentType
+
+    // ------------------------------------------------------------------------
+    // ComponentFactory
+    void ComponentFactory::add(const ComponentType* ty)
+    {
+        types.add(ty->name, ty);
+    }
+    
+    const ComponentType* ComponentFactory::from_name_or_null(core::HashedStringView name) const
+    {
+        auto found = types.find(name);
+        if(found != nullptr) { return *found; }
+        else { return nullptr; }
+    }
+
+    // ------------------------------------------------------------------------
+    // Archetype
+
+    Archetype::Archetype(std::vector<const ComponentType*> sorted_types)
+        : types(std::move(sorted_types))
+    {
+        std::size_t row_size = sizeof(Entity*);
+        for(const auto* type: types)
+        {
+            assert(type->size > 0 && "component type is missing size");
+            assert(type->alignment <= ArchetypeChunk::max_alignment);
+            row_size += type->size;
+        }
+
+        // each column can add padding, shrink the row count until everything fits
+        rows_per_chunk = ArchetypeChunk::memory_size / row_size;
+        while(true)
+        {
+            column_offsets.clear();
+            std::size_t offset = sizeof(Entity*) * rows_per_chunk;
+            for(const auto* type: types)
+            {
+                offset = (offset + type->alignment - 1) / type->alignment * type->alignment;
+                column_offsets.emplace_back(offset);
+                offset += type->size * rows_per_chunk;
+            }
+
+            if(offset <= ArchetypeChunk::memory_size) { break; }
+            rows_per_chunk -= 1;
+        }
+        assert(rows_per_chunk > 0 && "components are too big to fit in a chunk");
+    }
+
+    int Archetype::index_of(const ComponentType* type) const
+    {
+        const auto found = std::lower_bound(types.begin(), types.end(), type, std::less<const ComponentType*>{});
+        if(found != types.end() && *found == type) { return static_cast<int>(found - types.begin()); }
+        else { return -1; }
+    }
+
+    Entity** Archetype::get_entities(ArchetypeChunk* chunk) const
+    {
+        return reinterpret_cast<Entity**>(chunk->memory);
+    }
+
+    Component* Archetype::get_component(ArchetypeChunk* chunk, std::size_t column, std::size_t row) const
+    {
+        return reinterpret_cast<Component*>(chunk->memory + column_offsets[column] + row * types[column]->size);
+    }
+
+    // ------------------------------------------------------------------------
+    // ArchetypeStorage
+
+    ArchetypeStorage::~ArchetypeStorage()
+    {
+        for(auto& archetype: archetypes)
+        {
+            for(auto& chunk: archetype->chunks)
+            {
+                for(std::size_t row=0; row<chunk->count; row+=1)
+                {
+                    for(std::size_t column=0; column<archetype->types.size(); column+=1)
+                    {
+                        archetype->get_component(chunk.get(), column, row)->~Component();
+                    }
+                }
+            }
+        }
+    }
+
+    Archetype* ArchetypeStorage::get_or_create(std::vector<const ComponentType*> sorted_types)
+    {
+        for(auto& archetype: archetypes)
+        {
+            if(archetype->types == sorted_types) { return archetype.get(); }
+        }
+        return archetypes.emplace_back(std::make_unique<Archetype>(std::move(sorted_types))).get();
+    }
+
+    void ArchetypeStorage::add(Entity* entity, std::vector<const ComponentType*> types)
+    {
+        assert(entity != nullptr && entity->archetype == nullptr);
+        std::sort(types.begin(), types.end(), std::less<const ComponentType*>{});
+        assert(std::adjacent_find(types.begin(), types.end()) == types.end() && "types must be unique");
+
+        Archetype* archetype = get_or_create(std::move(types));
+
+        // all chunks except the last are always full
+        if(archetype->chunks.empty() || archetype->chunks.back()->count == archetype->rows_per_chunk)
+        {
+            archetype->chunks.emplace_back(std::make_unique<ArchetypeChunk>());
+        }
+        ArchetypeChunk* chunk = archetype->chunks.back().get();
+        const std::size_t row = chunk->count;
+        chunk->count += 1;
+
+        archetype->get_entities(chunk)[row] = entity;
+        for(std::size_t column=0; column<archetype->types.size(); column+=1)
+        {
+            void* memory = chunk->memory + archetype->column_offsets[column] + row * archetype->types[column]->size;
+            [[maybe_unused]] Component* c = archetype->types[column]->create_at(memory);
+            assert(static_cast<void*>(c) == memory && "Component must be the first base");
+        }
+
+        entity->archetype = archetype;
+        entity->archetype_chunk = archetype->chunks.size() - 1;
+        entity->archetype_row = row;
+    }
+
+    void ArchetypeStorage::remove(Entity* entity)
+    {
+        assert(entity != nullptr && entity->archetype != nullptr);
+        Archetype* archetype = entity->archetype;
+        ArchetypeChunk* chunk = archetype->chunks[entity->archetype_chunk].get();
+        const std::size_t row = entity->archetype_row;
+
+        for(std::size_t column=0; column<archetype->types.size(); column+=1)
+        {
+            archetype->get_component(chunk, column, row)->~Component();
+        }
+
+        // fill the hole with the last row to keep the chunks dense
+        ArchetypeChunk* last_chunk = archetype->chunks.back().get();
+        const std::size_t last_row = last_chunk->count - 1;
+        if(chunk != last_chunk || row != last_row)
+        {
+            Entity* moved = archetype->get_entities(last_chunk)[last_row];
+            archetype->get_entities(chunk)[row] = moved;
+            for(std::size_t column=0; column<archetype->types.size(); column+=1)
+            {
+                void* memory = chunk->memory + archetype->column_offsets[column] + row * archetype->types[column]->size;
+                archetype->types[column]->relocate(archetype->get_component(last_chunk, column, last_row), memory);
+            }
+            moved->archetype_chunk = entity->archetype_chunk;
+            moved->archetype_row = row;
+        }
+
+        last_chunk->count -= 1;
+        if(last_chunk->count == 0)
+        {
+            archetype->chunks.pop_back();
+        }
+
+        entity->archetype = nullptr;
+        entity->archetype_chunk = 0;
+        entity->archetype_row = 0;
+    }
+
+    Component* ArchetypeStorage::get(const Entity& entity, const ComponentType* type) const
+    {
+        if(entity.archetype == nullptr) { return nullptr; }
+        const int column = entity.archetype->index_of(type);
+        if(column < 0) { return nullptr; }
+        ArchetypeChunk* chunk = entity.archetype->chunks[entity.archetype_chunk].get();
+        return entity.archetype->get_component(chunk, static_cast<std::size_t>(column), entity.archetype_row);
+    }
+
+    // ------------------------------------------------------------------------
+    // EntitySystemType
+
+    EntitySystemType::EntitySystemType(core::HashedStringView n)
+        : name(n)
+    {
+    }
+
+    void EntitySystemDeleter::operator()(EntitySystem* s) const
+    {
+        if(s == nullptr) { return; }
+        assert(s->type != nullptr && "system wasn't created by a EntitySystemType");
+        s->type->destroy(s);
+    }
+
+    // ------------------------------------------------------------------------
+    // EntitySystemFactory
+    void EntitySystemFactory::add(const EntitySystemType* ty)
+    {
+        types.add(ty->name, ty);
+    }
+
+    const EntitySystemType* EntitySystemFactory::from_name_or_null(core::HashedStringView name) const
+    {
+        auto found = types.find(name);
+        if(found != nullptr) { return *found; }
+        else { return nullptr; }
+    }
+
+    // ------------------------------------------------------------------------
+    // WorldSystemType
+
+    // ------------------------------------------------------------------------
+    // WorldSystemFactory
+    void WorldSystemFactory::add(const WorldSystemType* ty)
+    {
+        types.add(ty->name, ty);
+    }
+
+    const WorldSystemType* WorldSystemFactory::from_name_or_null(core::HashedStringView name) const
+    {
+        auto found = types.find(name);
+        if(found != nullptr) { return *found; }
+        else { return nullptr; }
+    }
+
+
+    // ------------------------------------------------------------------------
+    // Entity
+
+    void Entity::update(UpdateStage stage, float dt)
+    {
+        systems.update(stage, dt);
+    }
+
+    // ------------------------------------------------------------------------
+    // ResourceRequests
+
+    void ResourceRequests::request(Load load)
+    {
+        loads.emplace_back(std::move(load));
+    }
+
+    // ------------------------------------------------------------------------
+    // SnapshotWriter
+
+    SnapshotWriter::SnapshotWriter(Snapshot* s)
+        : snapshot(s)
+    {
+        snapshot->data.clear();
+    }
+
+    void SnapshotWriter::write_bytes(const void* source, std::size_t size)
+    {
+        const auto* bytes = static_cast<const unsigned char*>(source);
+        snapshot->data.insert(snapshot->data.end(), bytes, bytes + size);
+    }
+
+    std::size_t SnapshotWriter::reserve(std::size_t size)
+    {
+        const std::size_t offset = snapshot->data.size();
+        snapshot->data.resize(offset + size);
+        return offset;
+    }
+
+    void SnapshotWriter::patch(std::size_t offset, const void* source, std::size_t size)
+    {
+        assert(offset + size <= snapshot->data.size());
+        std::memcpy(snapshot->data.data() + offset, source, size);
+    }
+
+    std::size_t SnapshotWriter::get_size() const
+    {
+        return snapshot->data.size();
+    }
+
+    // ------------------------------------------------------------------------
+    // SnapshotReader
+
+    SnapshotReader::SnapshotReader(const unsigned char* d, std::size_t s)
+        : data(d)
+        , size(s)
+    {
+    }
+
+    const unsigned char* SnapshotReader::read_view(std::size_t count)
+    {
+        if(size - offset < count) { return nullptr; }
+        const unsigned char* ret = data + offset;
+        offset += count;
+        return ret;
+    }
+
+    // ------------------------------------------------------------------------
+    // Entity handles
+
+    core::HandleTable<Entity>& entity_handles()
+    {
+        static core::HandleTable<Entity> table;
+        return table;
+    }
+
+    core::HandleTable<Component>& component_handles()
+    {
+        static core::HandleTable<Component> table;
+        return table;
+    }
+
+    Entity* resolve(EntityHandle handle)
+    {
+        Entity* entity = entity_handles().get(handle);
+        if(entity == nullptr || entity->alive.is_pending_removal()) { return nullptr; }
+        return entity;
+    }
+
+    Component* resolve(ComponentHandle handle)
+    {
+        Component* component = component_handles().get(handle);
+        if(component == nullptr || component->alive.is_pending_removal()) { return nullptr; }
+        return component;
+    }
+
+    Entity::Entity()
+        : handle(entity_handles().add(this))
+    {
+    }
+
+    Entity::~Entity()
+    {
+        entity_handles().remove(handle);
+    }
+
+    void Entity::activate(std::size_t activation_order, ActivationCommands* global_commands)
+    {
+        assert(state == EntityState::loaded);
+
+        // thread safe:
+        //   register each componet with all local systems
+        //   create per-stage local system update lists
+        for(auto& sys: local_systems)
+        {
+            for(auto& c: components)
+            {
+                if(c->state == ComponentState::initialized)
+                {
+                    sys->component_was_added(c.get());
+                }
+            }
+            sys->register_updates(&systems);
+        }
+
+        //   creates entity attachment (if required)
+        //   attachments are handled when the world rebuilds the update chains
+
+        // not thread safe, recorded and played back on the main thread:
+        //   registers each componet with all global systems
+        for(std::size_t index=0; index<components.size(); index+=1)
+        {
+            if(components[index]->state == ComponentState::initialized)
+            {
+                global_commands->added.push_back({activation_order, index, this, components[index].get()});
+            }
+        }
+
+        state = EntityState::activated;
+    }
+
+    void Entity::deactivate()
+    {
+        assert(state == EntityState::activated);
+        for(auto& sys: local_systems)
+        {
+            for(auto& c: components)
+            {
+                if(c->state == ComponentState::initialized)
+                {
+                    sys->component_was_removed(c.get());
+                }
+            }
+        }
+        systems = EntitySystemUpdate{};
+        state = EntityState::loaded;
+    }
+
+    void Entity::load(core::TaskQueue* io)
+    {
+        assert(state == EntityState::unloaded);
+        for(auto& c: components)
+        {
+            assert(c->state == ComponentState::unloaded);
+            ResourceRequests requests;
+            c->on_load(&requests);
+
+            c->state = ComponentState::loading;
+            c->resources_failed = false;
+            c->pending_resources = static_cast<int>(requests.loads.size());
+            for(auto& load: requests.loads)
+            {
+                Component* comp = c.get();
+                auto task = [comp, load = std::move(load)]()
+                {
+                    if(load() == false)
+                    {
+                        comp->resources_failed = true;
+                    }
+                    comp->pending_resources -= 1;
+                };
+
+                // without a queue everything is loaded on the calling thread
+                if(io != nullptr) { io->push(std::move(task)); }
+                else { task(); }
+            }
+        }
+    }
+
+    bool Entity::update_loading()
+    {
+        bool done = true;
+        for(auto& c: components)
+        {
+            if(c->state != ComponentState::loading) { continue; }
+            if(c->pending_resources.load() > 0)
+            {
+                done = false;
+                continue;
+            }
+            c->state = c->resources_failed ? ComponentState::load_failed : ComponentState::loaded;
+        }
+
+        if(done)
+        {
+            state = EntityState::loaded;
+        }
+        return done;
+    }
+
+    void Entity::initialize()
+    {
+        for(auto& c: components)
+        {
+            if(c->state != ComponentState::loaded) { continue; }
+            c->on_initialize();
+            c->state = ComponentState::initialized;
+        }
+    }
+
+    void Entity::unload()
+    {
+        assert(state != EntityState::activated && "deactivate before unloading");
+        for(auto& c: components)
+        {
+            assert(c->state != ComponentState::loading && "unloading a component that is loading isn't supported");
+            if(c->state == ComponentState::initialized)
+            {
+                c->on_shutdown();
+            }
+            if(c->state != ComponentState::unloaded)
+            {
+                c->on_unload();
+                c->state = ComponentState::unloaded;
+            }
+        }
+        state = EntityState::unloaded;
+    }
+
+    // ------------------------------------------------------------------------
+    // Component
+
+    Component::Component()
+        : handle(component_handles().add(this))
+    {
+    }
+
+    Component::Component(const Component& other)
+        : handle(component_handles().add(this))
+        , guid(other.guid)
+        , name(other.name)
+        , type(other.type)
+        , alive(other.alive)
+    {
+    }
+
+    Component& Component::operator=(const Component& other)
+    {
+        guid = other.guid;
+        name = other.name;
+        type = other.type;
+        alive = other.alive;
+        return *this;
+    }
+
+    Component::~Component()
+    {
+        component_handles().remove(handle);
+    }
+
+    void ComponentDeleter::operator()(Component* c) const
+    {
+        if(c == nullptr) { return; }
+        assert(c->type != nullptr && "component wasn't created by a ComponentType");
+        c->type->destroy(&c, 1);
+    }
+
+    void destroy_batch(std::vector<ComponentPtr>* batch)
+    {
+        // group on type so each pool is only locked once
+        std::sort(batch->begin(), batch->end(), [](const ComponentPtr& lhs, const ComponentPtr& rhs)
+        {
+            return std::less<const ComponentType*>{}(lhs->type, rhs->type);
+        });
+
+        static thread_local std::vector<Component*> same_type;
+        std::size_t index = 0;
+        while(index < batch->size())
+        {
+            const ComponentType* type = (*batch)[index]->type;
+            same_type.clear();
+            for(; index < batch->size() && (*batch)[index]->type == type; index+=1)
+            {
+                same_type.emplace_back((*batch)[index].release());
+            }
+            type->destroy(same_type.data(), same_type.size());
+        }
+        batch->clear();
+    }
+
+    void destroy_batch(std::vector<std::unique_ptr<Entity>>* batch)
+    {
+        static thread_local std::vector<ComponentPtr> components;
+        for(auto& ent: *batch)
+        {
+            std::move(ent->components.begin(), ent->components.end(), std::back_inserter(components));
+            ent->components.clear();
+        }
+        destroy_batch(&components);
+        batch->clear();
+    }
+
+    void Component::on_load(ResourceRequests*) {}
+    void Component::save(SnapshotWriter*) const {}
+    bool Component::load(SnapshotReader*, std::uint32_t) { return true; }
+    void Component::on_unload() {}
+    void Component::on_initialize() {}
+    void Component::on_shutdown() {}
+
+    // ------------------------------------------------------------------------
+    // SpatialComponent
+
+    const ComponentTypeOf<SpatialComponent> spatial_component_type{"spatial"};
+
+    void SpatialComponent::set_local_transform(const core::mat4f& m)
+    {
+        _local_transform = m;
+        if(hierarchy != nullptr)
+        {
+            hierarchy->set_local_transform(hierarchy_node, m);
+        }
+        else
+        {
+            update_world_transform();
+        }
+    }
+
+    void SpatialComponent::set_local_bounds(const core::Obb& bounds)
+    {
+        local_bounds = bounds;
+        if(hierarchy != nullptr)
+        {
+            hierarchy->set_local_bounds(hierarchy_node, bounds);
+        }
+        else
+        {
+            world_bounds = core::transform(_global_transform, local_bounds);
+            mark_moved();
+        }
+    }
+
+    const core::mat4f& SpatialComponent::get_global_transform()
+    {
+        if(hierarchy != nullptr) { return hierarchy->global_transforms[hierarchy_node]; }
+        else { return _global_transform; }
+    }
+
+    const core::Obb& SpatialComponent::get_world_bounds()
+    {
+        if(hierarchy != nullptr) { return hierarchy->world_bounds[hierarchy_node]; }
+        else { return world_bounds; }
+    }
+
+    void SpatialComponent::update_world_transform()
+    {
+        if(hierarchy != nullptr)
+        {
+            hierarchy->mark_dirty(hierarchy_node);
+            return;
+        }
+
+        // calculate world transform based on world
+        Entity* parent_entity = resolve(parent);
+        if(parent_entity != nullptr && parent_entity->is_spatial_entity())
+        {
+            _global_transform = parent_entity->root_component->get_global_transform() * _local_transform;
+        }
+        else
+        {
+            _global_transform = _local_transform;
+        }
+
+        // update world bounds
+        world_bounds = core::transform(_global_transform, local_bounds);
+        mark_moved();
+
+        // update world transforms on children
+        for(ComponentHandle child_handle: children)
+        {
+            if(auto* child = static_cast<SpatialComponent*>(resolve(child_handle)))
+            {
+                child->update_world_transform();
+            }
+        }
+    }
+
+    void SpatialComponent::save(SnapshotWriter* writer) const
+    {
+        const bool deferred = hierarchy != nullptr;
+        writer->write(_local_transform);
+        writer->write(deferred ? hierarchy->global_transforms[hierarchy_node] : _global_transform);
+        writer->write(local_bounds);
+        writer->write(deferred ? hierarchy->world_bounds[hierarchy_node] : world_bounds);
+    }
+
+    bool SpatialComponent::load(SnapshotReader* reader, std::uint32_t)
+    {
+        // global transform and bounds are saved so the hierarchy doesn't need to be recalculated
+        const bool ok = reader->read(&_local_transform) && reader->read(&_global_transform)
+            && reader->read(&local_bounds) && reader->read(&world_bounds);
+        if(ok && hierarchy != nullptr)
+        {
+            hierarchy->local_transforms[hierarchy_node] = _local_transform;
+            hierarchy->global_transforms[hierarchy_node] = _global_transform;
+            hierarchy->local_bounds[hierarchy_node] = local_bounds;
+            hierarchy->world_bounds[hierarchy_node] = world_bounds;
+        }
+        if(ok) { mark_moved(); }
+        return ok;
+    }
+
+    void SpatialComponent::mark_moved()
+    {
+        if(spatial_index != nullptr)
+        {
+            spatial_index->mark_moved(spatial_slot);
+        }
+    }
+
+    // ------------------------------------------------------------------------
+    // TransformHierarchy
+
+    void TransformHierarchy::rebuild(const std::vector<Entity*>& update_order)
+    {
+        clear();
+
+        std::unordered_map<const Entity*, std::int32_t> node_from_entity;
+        for(Entity* ent: update_order)
+        {
+            if(ent->is_spatial_entity() == false) { continue; }
+            SpatialComponent* spatial = ent->root_component;
+
+            const auto node = static_cast<std::int32_t>(components.size());
+            node_from_entity.emplace(ent, node);
+
+            const auto found_parent = node_from_entity.find(resolve(spatial->parent));
+            const std::int32_t parent_node = found_parent != node_from_entity.end() ? found_parent->second : -1;
+            assert(parent_node < node && "update order isn't sorted parent before child");
+
+            parents.emplace_back(parent_node);
+            local_transforms.emplace_back(spatial->_local_transform);
+            global_transforms.emplace_back(spatial->_global_transform);
+            local_bounds.emplace_back(spatial->local_bounds);
+            world_bounds.emplace_back(spatial->world_bounds);
+            dirty.emplace_back(1);
+            components.emplace_back(spatial);
+
+            spatial->hierarchy = this;
+            spatial->hierarchy_node = static_cast<std::uint32_t>(node);
+        }
+        any_dirty = components.empty() == false;
+    }
+
+    void TransformHierarchy::clear()
+    {
+        if(is_dirty()) { update(); }
+
+        for(std::size_t node=0; node<components.size(); node+=1)
+        {
+            SpatialComponent* spatial = components[node];
+            spatial->_global_transform = global_transforms[node];
+            spatial->world_bounds = world_bounds[node];
+            spatial->hierarchy = nullptr;
+            spatial->hierarchy_node = 0;
+        }
+
+        parents.clear();
+        local_transforms.clear();
+        global_transforms.clear();
+        local_bounds.clear();
+        world_bounds.clear();
+        dirty.clear();
+        components.clear();
+        any_dirty = false;
+    }
+
+    void TransformHierarchy::set_local_transform(std::uint32_t node, const core::mat4f& m)
+    {
+        local_transforms[node] = m;
+        mark_dirty(node);
+    }
+
+    void TransformHierarchy::set_local_bounds(std::uint32_t node, const core::Obb& bounds)
+    {
+        local_bounds[node] = bounds;
+        mark_dirty(node);
+    }
+
+    void TransformHierarchy::mark_dirty(std::uint32_t node)
+    {
+        dirty[node] = 1;
+        any_dirty.store(true, std::memory_order_relaxed);
+    }
+
+    void TransformHierarchy::update()
+    {
+        // parents are always before children so a single pass is enough
+        // and the parent dirty flag has been propagated when we reach the child
+        const std::size_t count = parents.size();
+        for(std::size_t node=0; node<count; node+=1)
+        {
+            const std::int32_t parent = parents[node];
+            if(parent >= 0)
+            {
+                dirty[node] |= dirty[static_cast<std::size_t>(parent)];
+            }
+            if(dirty[node] == 0) { continue; }
+
+            global_transforms[node] = parent >= 0
+                ? global_transforms[static_cast<std::size_t>(parent)] * local_transforms[node]
+                : local_transforms[node];
+            world_bounds[node] = core::transform(global_transforms[node], local_bounds[node]);
+            components[node]->mark_moved();
+        }
+
+        std::fill(dirty.begin(), dirty.end(), std::uint8_t{0});
+        any_dirty = false;
+    }
+
+    // ------------------------------------------------------------------------
+    // SpatialIndex
+
+    SpatialIndex::SpatialIndex()
+        : bvh(0.1f)
+    {
+    }
+
+    void SpatialIndex::add(Entity* entity)
+    {
+        assert(entity->is_spatial_entity());
+        SpatialComponent* spatial = entity->root_component;
+        assert(spatial->spatial_index == nullptr && "already added");
+
+        std::uint32_t slot = 0;
+        if(free_slots.empty())
+        {
+            slot = static_cast<std::uint32_t>(components.size());
+            components.emplace_back();
+            entities.emplace_back();
+            proxies.emplace_back();
+            moved.emplace_back();
+        }
+        else
+        {
+            slot = free_slots.back();
+            free_slots.pop_back();
+        }
+
+        components[slot] = spatial;
+        entities[slot] = entity->handle;
+        proxies[slot] = bvh.add(core::to_aabb(spatial->get_world_bounds()), slot);
+        moved[slot] = 0;
+
+        spatial->spatial_index = this;
+        spatial->spatial_slot = slot;
+    }
+
+    void SpatialIndex::remove(Entity* entity)
+    {
+        assert(entity->is_spatial_entity());
+        SpatialComponent* spatial = entity->root_component;
+        assert(spatial->spatial_index == this);
+
+        const std::uint32_t slot = spatial->spatial_slot;
+        bvh.remove(proxies[slot]);
+        components[slot] = nullptr;
+        entities[slot] = {};
+        moved[slot] = 0;
+        free_slots.emplace_back(slot);
+
+        spatial->spatial_index = nullptr;
+        spatial->spatial_slot = 0;
+    }
+
+    void SpatialIndex::mark_moved(std::uint32_t slot)
+    {
+        moved[slot] = 1;
+        any_moved.store(true, std::memory_order_relaxed);
+    }
+
+    void SpatialIndex::update()
+    {
+        if(any_moved.load(std::memory_order_relaxed) == false) { return; }
+        PROFILE_SCOPE("spatial index");
+
+        const std::size_t count = moved.size();
+        for(std::size_t slot=0; slot<count; slot+=1)
+        {
+            if(moved[slot] == 0) { continue; }
+            moved[slot] = 0;
+            bvh.move(proxies[slot], core::to_aabb(components[slot]->get_world_bounds()));
+        }
+        any_moved = false;
+    }
+
+    template<typename TShape>
+    void SpatialIndex::query_impl(const TShape& shape, std::vector<EntityHandle>* result) const
+    {
+        bvh.query(shape, [this, result](std::uint32_t slot)
+        {
+            result->emplace_back(entities[slot]);
+        });
+    }
+
+    template<typename TShape>
+    void SpatialIndex::query_batch_impl(const TShape* shapes, std::size_t count, std::vector<EntityHandle>* results, core::WorkerPool* workers) const
+    {
+        const auto job = [this, shapes, results](std::size_t index)
+        {
+            results[index].clear();
+            query_impl(shapes[index], &results[index]);
+        };
+
+        if(workers == nullptr)
+        {
+            for(std::size_t index=0; index<count; index+=1) { job(index); }
+        }
+        else
+        {
+            workers->run(count, job);
+        }
+    }
+
+    void SpatialIndex::query(const core::Frustum& frustum, std::vector<EntityHandle>* result) const { query_impl(frustum, result); }
+    void SpatialIndex::query(const core::Sphere& sphere, std::vector<EntityHandle>* result) const { query_impl(sphere, result); }
+    void SpatialIndex::query(const core::Ray& ray, std::vector<EntityHandle>* result) const { query_impl(ray, result); }
+
+    void SpatialIndex::query_batch(const core::Frustum* shapes, std::size_t count, std::vector<EntityHandle>* results, core::WorkerPool* workers) const
+    {
+        query_batch_impl(shapes, count, results, workers);
+    }
+
+    void SpatialIndex::query_batch(const core::Sphere* shapes, std::size_t count, std::vector<EntityHandle>* results, core::WorkerPool* workers) const
+    {
+        query_batch_impl(shapes, count, results, workers);
+    }
+
+    void SpatialIndex::query_batch(const core::Ray* shapes, std::size_t count, std::vector<EntityHandle>* results, core::WorkerPool* workers) const
+    {
+        query_batch_impl(shapes, count, results, workers);
+    }
+
+    void attach(World* world, EntityHandle parent_handle, EntityHandle child_handle)
+    {
+        assert(world != nullptr);
+        Entity* parent = resolve(parent_handle);
+        Entity* child = resolve(child_handle);
+        assert(parent != nullptr && child != nullptr && "entity has been destroyed");
+        assert(parent->is_spatial_entity() && child->is_spatial_entity());
+        assert(resolve(child->root_component->parent) == nullptr && "entity is already attached");
+        assert(parent != child);
+
+        // todo(Gustav): add socket attachment
+        child->root_component->parent = parent_handle;
+        parent->root_component->children.emplace_back(child->root_component->handle);
+        child->root_component->update_world_transform();
+
+        // attached entities must be on the same chain as the parent
+        world->update_chains_dirty = true;
+    }
+
+    // ------------------------------------------------------------------------
+    // RequestedComponents
+
+    // ------------------------------------------------------------------------
+    // EntitySystem
+
+    // ------------------------------------------------------------------------
+    // WorldSystem
+
+    // ------------------------------------------------------------------------
+    // WorldSystemWithPrio
+    WorldSystemWithPrio::WorldSystemWithPrio(WorldSystem* s, int p)
+        : system(s)
+        , prio(p)
+    {
+    }
+
+    // ------------------------------------------------------------------------
+    // WorldSystemUpdateStageList
+    void WorldSystemUpdateStageList::update(UpdateStage stage)
+    {
+        for(auto& es: systems)
+        {
+            PROFILE_SCOPE(es.system->type != nullptr ? es.system->type->name.string : "WorldSystem");
+            es.system->update(stage);
+        }
+    }
+
+    void WorldSystemUpdateStageList::add(WorldSystem* sys, int prio)
+    {
+        // insert after all with the same prio, list is always sorted
+        const auto where = std::upper_bound(systems.begin(), systems.end(), prio, [](int p, const WorldSystemWithPrio& es)
+        {
+            return p < es.prio;
+        });
+        systems.emplace(where, sys, prio);
+    }
+
+    void WorldSystemUpdateStageList::remove(WorldSystem* sys)
+    {
+        // keep the prio order
+        systems.erase(std::remove_if(systems.begin(), systems.end(), [sys](const WorldSystemWithPrio& es) { return es.system == sys;}), systems.end());
+    }
+
+    // ------------------------------------------------------------------------
+    // WorldSystemUpdate
+
+    void WorldSystemUpdate::update(UpdateStage stage)
+    {
+        systems[static_cast<std::size_t>(stage)].update(stage);
+    }
+
+    void WorldSystemUpdate::add(WorldSystem* system, UpdateStage stage, int prio)
+    {
+        systems[static_cast<std::size_t>(stage)].add(system, prio);
+    }
+
+    void WorldSystemUpdate::remove(WorldSystem* system, UpdateStage stage)
+    {
+        systems[static_cast<std::size_t>(stage)].remove(system);
+    }
+
+    // ------------------------------------------------------------------------
+    // WorldCommands
+
+    namespace
+    {
+        thread_local WorldCommands* current_world_commands = nullptr;
+    }
+
+    EntityHandle WorldCommands::spawn(std::unique_ptr<Entity> entity)
+    {
+        assert(entity != nullptr);
+        const EntityHandle handle = entity->handle;
+        commands.push_back({Type::spawn, handle, {}, {}, std::move(entity), nullptr});
+        return handle;
+    }
+
+    void WorldCommands::destroy(EntityHandle entity)
+    {
+        commands.push_back({Type::destroy, entity, {}, {}, nullptr, nullptr});
+    }
+
+    void WorldCommands::add_component(EntityHandle entity, ComponentPtr component)
+    {
+        assert(component != nullptr);
+        commands.push_back({Type::add_component, entity, {}, {}, nullptr, std::move(component)});
+    }
+
+    void WorldCommands::remove_component(EntityHandle entity, ComponentHandle component)
+    {
+        commands.push_back({Type::remove_component, entity, {}, component, nullptr, nullptr});
+    }
+
+    void WorldCommands::attach(EntityHandle parent, EntityHandle child)
+    {
+        commands.push_back({Type::attach, parent, child, {}, nullptr, nullptr});
+    }
+
+    WorldCommands* WorldCommands::get_current()
+    {
+        return current_world_commands;
+    }
+
+    WorldCommands::Scope::Scope(WorldCommands* commands)
+        : previous(current_world_commands)
+    {
+        current_world_commands = commands;
+    }
+
+    WorldCommands::Scope::~Scope()
+    {
+        current_world_commands = previous;
+    }
+
+    // ------------------------------------------------------------------------
+    // EntityUpdatePlan
+
+    EntityUpdatePlan::Group* EntityUpdatePlan::get_or_create_group(UpdateStage stage, int prio, std::uint32_t depth, std::uint32_t rank, const EntitySystemType* type)
+    {
+        // sorted on prio, depth, rank and then name so the order is the same between runs
+        const auto less = [depth, rank, type](const Group& g, int p)
+        {
+            if(g.prio != p) { return g.prio < p; }
+            if(g.depth != depth) { return g.depth < depth; }
+            if(g.rank != rank) { return g.rank < rank; }
+            if(g.type->name != type->name) { return g.type->name.string < type->name.string; }
+            return std::less<const EntitySystemType*>{}(g.type, type);
+        };
+
+        auto& groups = stages[static_cast<std::size_t>(stage)];
+        const auto found = std::lower_bound(groups.begin(), groups.end(), prio, less);
+        if(found != groups.end() && found->prio == prio && found->depth == depth && found->rank == rank && found->type == type)
+        {
+            return &*found;
+        }
+
+        Group group;
+        group.prio = prio;
+        group.depth = depth;
+        group.rank = rank;
+        group.type = type;
+        return &*groups.emplace(found, std::move(group));
+    }
+
+    void EntityUpdatePlan::rebuild(const std::vector<Entity*>& update_order)
+    {
+        // keep the groups and their memory, most of them are reused
+        for(auto& groups: stages)
+        {
+            for(auto& group: groups)
+            {
+                for(auto& slot: group.slots) { slot.systems.clear(); }
+            }
+        }
+
+        for(Entity* entity: update_order)
+        {
+            if(entity->update_slot == dormant_update_slot) { continue; }
+            const auto depth = static_cast<std::uint32_t>(entity->update_key & 0xFFFFFFFF);
+
+            for(unsigned int stage=0; stage<UpdateStageCount; stage+=1)
+            {
+                const auto& systems = entity->systems.systems[stage].get_systems();
+                std::uint32_t rank = 0;
+                for(std::size_t index=0; index<systems.size(); index+=1)
+                {
+                    const auto& es = systems[index];
+                    assert(es.system->type != nullptr && "system wasn't created by a EntitySystemType");
+                    rank = index > 0 && systems[index-1].prio == es.prio ? rank + 1 : 0;
+                    Group* group = get_or_create_group(static_cast<UpdateStage>(stage), es.prio, depth, rank, es.system->type);
+                    group->slots[entity->update_slot].systems.emplace_back(es.system);
+                }
+            }
+        }
+
+        for(auto& groups: stages)
+        {
+            const auto is_empty = [](const Group& group)
+            {
+                return std::all_of(group.slots.begin(), group.slots.end(), [](const Slot& slot) { return slot.systems.empty(); });
+            };
+            groups.erase(std::remove_if(groups.begin(), groups.end(), is_empty), groups.end());
+            for(auto& group: groups)
+            {
+                for(auto& slot: group.slots) { build_batches(&slot); }
+            }
+        }
+    }
+
+    void EntityUpdatePlan::begin_frame(float dt)
+    {
+        frame += 1;
+        time += dt;
+        for(std::uint8_t slot=0; slot<UpdateSlotCount; slot+=1)
+        {
+            if(is_due(slot) == false) { continue; }
+            slot_dt[slot] = static_cast<float>(time - slot_time[slot]);
+            slot_time[slot] = time;
+        }
+    }
+
+    bool EntityUpdatePlan::is_due(std::uint8_t slot) const
+    {
+        if(slot == dormant_update_slot) { return false; }
+        return frame % get_update_slot_period(slot) == get_update_slot_phase(slot);
+    }
+
+    void EntityUpdatePlan::build_batches(Slot* slot)
+    {
+        // number of systems a job should update
+        // a group is a single depth so there is no parent/child order to keep inside it, split anywhere
+        constexpr std::size_t batch_size = 128;
+
+        slot->batches.clear();
+        for(std::size_t begin=0; begin<slot->systems.size(); begin+=batch_size)
+        {
+            slot->batches.emplace_back(begin, std::min(begin + batch_size, slot->systems.size()));
+        }
+    }
+
+    void EntityUpdatePlan::update(UpdateStage stage, core::WorkerPool* workers, WorldCommands* commands_per_thread)
+    {
+        for(auto& group: stages[static_cast<std::size_t>(stage)])
+        {
+            // one job list for all due slots so there is a single run per group
+            group.due_batches.clear();
+            for(std::uint8_t slot_index=0; slot_index<UpdateSlotCount; slot_index+=1)
+            {
+                Slot& slot = group.slots[slot_index];
+                if(slot.systems.empty() || is_due(slot_index) == false) { continue; }
+                for(const auto& [begin, end]: slot.batches)
+                {
+                    group.due_batches.push_back({&slot, begin, end, slot_dt[slot_index]});
+                }
+            }
+            if(group.due_batches.empty()) { continue; }
+
+            workers->run(group.due_batches.size(), [&group, stage, commands_per_thread](std::size_t batch_index)
+            {
+                WorldCommands::Scope commands_scope(&commands_per_thread[core::WorkerPool::get_thread_index()]);
+                // one scope per batch, Profiler::get_summary sums them per type
+                PROFILE_SCOPE(group.type->name.string);
+                const Batch& batch = group.due_batches[batch_index];
+                group.type->update_all(batch.slot->systems.data() + batch.begin, batch.end - batch.begin, stage, batch.dt);
+            });
+        }
+    }
+
+    // ------------------------------------------------------------------------
+    // QueryCache
+
+    QueryCache::QueryCache(std::vector<const ComponentType*> required_types, std::vector<const ComponentType*> optional_types)
+        : required(std::move(required_types))
+        , optional(std::move(optional_types))
+        , column_count(required.size() + optional.size())
+    {
+    }
+
+    void QueryCache::update_entity(Entity* entity)
+    {
+        const auto find_component = [entity](const ComponentType* type) -> Component*
+        {
+            for(auto& c: entity->components)
+            {
+                if(c->type == type && c->state == ComponentState::initialized) { return c.get(); }
+            }
+            return nullptr;
+        };
+
+        // fill a temporary row so a entity that no longer matches can be removed before anything is written
+        thread_local std::vector<Component*> row;
+        row.clear();
+        if(entity->state == EntityState::activated)
+        {
+            for(const ComponentType* type: required)
+            {
+                Component* c = find_component(type);
+                if(c == nullptr) { break; }
+                row.emplace_back(c);
+            }
+        }
+        if(row.size() != required.size())
+        {
+            remove_entity(entity);
+            return;
+        }
+        for(const ComponentType* type: optional)
+        {
+            row.emplace_back(find_component(type));
+        }
+
+        const auto [found, inserted] = row_of.try_emplace(entity, entities.size());
+        if(inserted)
+        {
+            entities.emplace_back(entity);
+            components.insert(components.end(), row.begin(), row.end());
+        }
+        else
+        {
+            std::copy(row.begin(), row.end(), components.begin() + static_cast<std::ptrdiff_t>(found->second * column_count));
+        }
+    }
+
+    void QueryCache::remove_entity(const Entity* entity)
+    {
+        const auto found = row_of.find(entity);
+        if(found == row_of.end()) { return; }
+
+        // swap with the last row to keep the rows contiguous
+        const std::size_t row = found->second;
+        const std::size_t last = entities.size() - 1;
+        row_of.erase(found);
+        if(row != last)
+        {
+            entities[row] = entities[last];
+            std::copy_n(components.begin() + static_cast<std::ptrdiff_t>(last * column_count), column_count,
+                components.begin() + static_cast<std::ptrdiff_t>(row * column_count));
+            row_of[entities[row]] = row;
+        }
+        entities.pop_back();
+        components.resize(components.size() - column_count);
+    }
+
+    // ------------------------------------------------------------------------
+    // World
+
+    QueryCache* World::get_or_create_query(std::vector<const ComponentType*> required, std::vector<const ComponentType*> optional)
+    {
+        for(auto& query: queries)
+        {
+            if(query->required == required && query->optional == optional) { return query.get(); }
+        }
+
+        auto& query = queries.emplace_back(std::make_unique<QueryCache>(std::move(required), std::move(optional)));
+        for(auto& ent: entities)
+        {
+            query->update_entity(ent.get());
+        }
+        return query.get();
+    }
+
+    World::World()
+        : workers(std::make_unique<core::WorkerPool>(core::default_worker_count()))
+        , commands(workers->get_worker_count() + 1)
+        , io(2)
+    {
+    }
+
+    WorldCommands& World::get_commands()
+    {
+        return commands[core::WorkerPool::get_thread_index()];
+    }
+
+    void World::play_back_commands()
+    {
+        for(auto& buffer: commands)
+        {
+            // commands may record new commands so take them first
+            std::vector<WorldCommands::Command> recorded = std::move(buffer.commands);
+            buffer.commands.clear();
+
+            for(auto& cmd: recorded)
+            {
+                switch(cmd.type)
+                {
+                case WorldCommands::Type::spawn:
+                    add(std::move(cmd.new_entity));
+                    break;
+                case WorldCommands::Type::destroy:
+                    if(Entity* ent = resolve(cmd.entity)) { destroy(ent); }
+                    break;
+                case WorldCommands::Type::add_component:
+                    if(Entity* ent = resolve(cmd.entity)) { add_component(ent, std::move(cmd.new_component)); }
+                    break;
+                case WorldCommands::Type::remove_component:
+                    {
+                        Entity* ent = resolve(cmd.entity);
+                        Component* c = resolve(cmd.component_handle);
+                        if(ent != nullptr && c != nullptr) { remove_component(ent, c); }
+                    }
+                    break;
+                case WorldCommands::Type::attach:
+                    if(resolve(cmd.entity) != nullptr && resolve(cmd.other_entity) != nullptr)
+                    {
+                        attach(this, cmd.entity, cmd.other_entity);
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    void World::destroy(Entity* entity)
+    {
+        if(entity->state != EntityState::activated) { return; }
+
+        const std::size_t index = entity->world_index;
+        assert(index < entities.size() && entities[index].get() == entity && "entity isn't part of this world");
+
+        for(auto& c: entity->components)
+        {
+            if(c->state != ComponentState::initialized) { continue; }
+            for(auto& sys: systems)
+            {
+                sys->component_was_removed(entity, c.get());
+            }
+        }
+        // removed from the update plan when it's rebuilt before the next stage
+        slot_load[entity->target_update_slot] -= 1;
+        for(auto& query: queries)
+        {
+            query->remove_entity(entity);
+        }
+        if(entity->is_spatial_entity()) { spatial_index.remove(entity); }
+        entity->deactivate();
+        // same hooks as remove_component, on_shutdown and on_unload
+        entity->unload();
+
+        // children becomes roots and the parent forgets about us
+        if(entity->is_spatial_entity())
+        {
+            SpatialComponent* spatial = entity->root_component;
+            for(ComponentHandle child_handle: spatial->children)
+            {
+                if(auto* child = static_cast<SpatialComponent*>(resolve(child_handle)))
+                {
+                    child->parent = {};
+                    child->update_world_transform();
+                }
+            }
+            spatial->children.clear();
+            detach(entity);
+        }
+
+        // the components die with the entity so their handles stop resolving too
+        for(auto& c: entity->components)
+        {
+            c->alive.kill();
+        }
+        dead_entities.retire(std::move(entities[index]));
+        core::swap_back_and_erase(&entities, index);
+        if(index < entities.size()) { entities[index]->world_index = index; }
+        update_chains_dirty = true;
+    }
+
+    void World::add_component(Entity* entity, ComponentPtr component)
+    {
+        Component* c = entity->components.emplace_back(std::move(component)).get();
+        if(entity->state != EntityState::activated) { return; }
+
+        // load directly, the entity is already in the world
+        ResourceRequests requests;
+        c->on_load(&requests);
+        bool loaded = true;
+        for(auto& load: requests.loads)
+        {
+            loaded = load() && loaded;
+        }
+        c->state = loaded ? ComponentState::loaded : ComponentState::load_failed;
+        if(loaded == false) { return; }
+
+        c->on_initialize();
+        c->state = ComponentState::initialized;
+
+        for(auto& sys: entity->local_systems)
+        {
+            sys->component_was_added(c);
+        }
+        for(auto& sys: systems)
+        {
+            sys->component_was_added(entity, c);
+        }
+        for(auto& query: queries)
+        {
+            query->update_entity(entity);
+        }
+    }
+
+    void World::remove_component(Entity* entity, Component* component)
+    {
+        assert(component != entity->root_component && "destroy the entity instead of removing the root component");
+        const auto found = std::find_if(entity->components.begin(), entity->components.end(), [component](const ComponentPtr& c) { return c.get() == component; });
+        if(found == entity->components.end()) { return; }
+
+        if(component->state == ComponentState::initialized && entity->state == EntityState::activated)
+        {
+            for(auto& sys: entity->local_systems)
+            {
+                sys->component_was_removed(component);
+            }
+            for(auto& sys: systems)
+            {
+                sys->component_was_removed(entity, component);
+            }
+        }
+
+        if(component->state == ComponentState::initialized) { component->on_shutdown(); }
+        if(component->state != ComponentState::unloaded) { component->on_unload(); }
+        component->state = ComponentState::unloaded;
+        for(auto& query: queries)
+        {
+            query->update_entity(entity);
+        }
+
+        // deleted in bulk a few frames later
+        dead_components.retire(std::move(*found));
+        entity->components.erase(found);
+    }
+
+    void World::load(std::unique_ptr<Entity> entity)
+    {
+        assert(entity != nullptr && entity->state == EntityState::unloaded);
+        entity->load(&io);
+        loading_entities.emplace_back(std::move(entity));
+    }
+
+    std::size_t World::get_loading_count() const
+    {
+        return loading_entities.size() + pending_activation.size();
+    }
+
+    void World::update_loading()
+    {
+        // activate the entities that were initialized last frame
+        if(pending_activation.empty() == false)
+        {
+            activate(pending_activation);
+            for(auto& ent: pending_activation)
+            {
+                add_active(std::move(ent));
+            }
+            pending_activation.clear();
+            update_chains_dirty = true;
+        }
+
+        // entities that are done loading goes to the initialization batch
+        // keep the load order so activation is deterministic
+        std::vector<std::unique_ptr<Entity>> loaded;
+        for(auto& ent: loading_entities)
+        {
+            if(ent->update_loading())
+            {
+                loaded.emplace_back(std::move(ent));
+            }
+        }
+        loading_entities.erase(std::remove(loading_entities.begin(), loading_entities.end(), nullptr), loading_entities.end());
+
+        // one entity per job
+        workers->run(loaded.size(), [&loaded](std::size_t index)
+        {
+            loaded[index]->initialize();
+        });
+
+        for(auto& ent: loaded)
+        {
+            pending_activation.emplace_back(std::move(ent));
+        }
+    }
+
+    void World::add_active(std::unique_ptr<Entity> entity)
+    {
+        entity->world_index = entities.size();
+        entities.emplace_back(std::move(entity));
+    }
+
+    void World::detach(Entity* child)
     {
-        /// get requested components
-        /// @todo move to a entity sytem type
-        virtual RequestedComponents get_component_requests() = 0;
+        assert(child->is_spatial_entity());
+        SpatialComponent* spatial = child->root_component;
+        if(Entity* parent = resolve(spatial->parent); parent != nullptr && parent->is_spatial_entity())
+        {
+            auto& siblings = parent->root_component->children;
+            siblings.erase(std::remove(siblings.begin(), siblings.end(), spatial->handle), siblings.end());
+        }
+        spatial->parent = {};
+        update_chains_dirty = true;
+    }
+
+    Entity* World::add(std::unique_ptr<Entity> entity)
+    {
+        assert(entity != nullptr && entity->state != EntityState::activated);
+        if(entity->state == EntityState::unloaded)
+        {
+            entity->load(nullptr);
+            [[maybe_unused]] const bool loaded = entity->update_loading();
+            assert(loaded);
+            entity->initialize();
+        }
+
+        Entity* ret = entity.get();
+        std::vector<std::unique_ptr<Entity>> to_activate;
+        to_activate.emplace_back(std::move(entity));
+        activate(to_activate);
+        add_active(std::move(to_activate[0]));
+        update_chains_dirty = true;
+        return ret;
+    }
+
+    void World::add_system(std::unique_ptr<WorldSystem> system)
+    {
+        assert(system != nullptr);
+        WorldSystem* sys = systems.emplace_back(std::move(system)).get();
+        sys->system_was_added_to_world();
+        sys->register_updates(&system_update);
+
+        for(auto& ent: entities)
+        {
+            for(auto& c: ent->components)
+            {
+                if(c->state == ComponentState::initialized)
+                {
+                    sys->component_was_added(ent.get(), c.get());
+                }
+            }
+        }
+    }
+
+    void World::activate(const std::vector<std::unique_ptr<Entity>>& to_activate)
+    {
+        activation_commands.resize(workers->get_worker_count() + 1);
+        for(auto& commands: activation_commands)
+        {
+            commands.added.clear();
+        }
+
+        // local systems are per entity so this is safe to run with one entity per job
+        workers->run(to_activate.size(), [this, &to_activate](std::size_t index)
+        {
+            ActivationCommands* commands = &activation_commands[core::WorkerPool::get_thread_index()];
+            to_activate[index]->activate(index, commands);
+        });
+
+        for(auto& ent: to_activate)
+        {
+            // added to the update plan when the chains are rebuilt
+            slot_load[ent->target_update_slot] += 1;
+            if(ent->is_spatial_entity()) { spatial_index.add(ent.get()); }
+        }
+
+        // merge and sort so world systems get the components in the same order regardless of what thread activated them
+        merged_activation_commands.clear();
+        for(auto& commands: activation_commands)
+        {
+            merged_activation_commands.insert(merged_activation_commands.end(), commands.added.begin(), commands.added.end());
+        }
+        std::sort(merged_activation_commands.begin(), merged_activation_commands.end(), [](const auto& lhs, const auto& rhs)
+        {
+            if(lhs.activation_order != rhs.activation_order) { return lhs.activation_order < rhs.activation_order; }
+            return lhs.component_index < rhs.component_index;
+        });
+
+        for(const auto& added: merged_activation_commands)
+        {
+            for(auto& sys: systems)
+            {
+                sys->component_was_added(added.entity, added.component);
+            }
+        }
+
+        for(auto& query: queries)
+        {
+            for(auto& ent: to_activate)
+            {
+                query->update_entity(ent.get());
+            }
+        }
+    }
+
+    void World::set_worker_count(std::size_t count)
+    {
+        if(workers->get_worker_count() == count) { return; }
+        workers = std::make_unique<core::WorkerPool>(count);
+
+        assert(std::all_of(commands.begin(), commands.end(), [](const WorldCommands& c) { return c.is_empty(); }));
+        commands.resize(count + 1);
+    }
+
+    void World::save_snapshot(Snapshot* snapshot) const
+    {
+        SnapshotWriter writer(snapshot);
+
+        // the type table is written after the entities since the types aren't known up front
+        std::vector<const ComponentType*> types;
+        std::unordered_map<const ComponentType*, std::uint32_t> type_index;
+
+        writer.write(Snapshot::magic);
+        writer.write(Snapshot::format_version);
+        const std::size_t type_table_offset = writer.reserve(sizeof(std::uint64_t));
+        writer.write(static_cast<std::uint32_t>(entities.size()));
+
+        for(const auto& ent: entities)
+        {
+            writer.write(ent->handle);
+            writer.write(ent->is_spatial_entity() ? ent->root_component->parent : EntityHandle{});
+            writer.write(static_cast<std::uint32_t>(ent->components.size()));
+            for(const auto& c: ent->components)
+            {
+                assert(c->type != nullptr);
+                const auto [found, inserted] = type_index.try_emplace(c->type, static_cast<std::uint32_t>(types.size()));
+                if(inserted) { types.emplace_back(c->type); }
+
+                writer.write(found->second);
+                const std::size_t size_offset = writer.reserve(sizeof(std::uint32_t));
+                const std::size_t start = writer.get_size();
+                c->save(&writer);
+                const auto size = static_cast<std::uint32_t>(writer.get_size() - start);
+                writer.patch(size_offset, &size, sizeof(size));
+            }
+        }
+
+        const auto type_table = static_cast<std::uint64_t>(writer.get_size());
+        writer.patch(type_table_offset, &type_table, sizeof(type_table));
+        writer.write(static_cast<std::uint32_t>(types.size()));
+        for(const auto* type: types)
+        {
+            writer.write(type->name.hash);
+            writer.write(type->schema_version);
+        }
+    }
+
+    bool World::restore_snapshot(const Snapshot& snapshot, const ComponentFactory* factory)
+    {
+        SnapshotReader reader(snapshot.data.data(), snapshot.data.size());
+
+        std::uint32_t magic = 0;
+        std::uint32_t version = 0;
+        std::uint64_t type_table = 0;
+        std::uint32_t entity_count = 0;
+        if(!reader.read(&magic) || magic != Snapshot::magic) { return false; }
+        if(!reader.read(&version) || version != Snapshot::format_version) { return false; }
+        if(!reader.read(&type_table) || type_table > snapshot.data.size()) { return false; }
+        if(!reader.read(&entity_count)) { return false; }
+
+        struct SavedType { std::uint64_t hash; std::uint32_t schema_version; const ComponentType* type; };
+        std::vector<SavedType> saved_types;
+        {
+            SnapshotReader types_reader(snapshot.data.data() + type_table, snapshot.data.size() - type_table);
+            std::uint32_t type_count = 0;
+            if(!types_reader.read(&type_count)) { return false; }
+            saved_types.resize(type_count);
+            for(auto& t: saved_types)
+            {
+                if(!types_reader.read(&t.hash) || !types_reader.read(&t.schema_version)) { return false; }
+
+                // HashTable only compares the hash so a view without the string is enough for the lookup
+                core::HashedStringView name;
+                name.hash = t.hash;
+                t.type = factory != nullptr ? factory->from_name_or_null(name) : nullptr;
+            }
+        }
+
+        // calls on_entity(entity index, handle, parent, component count) and on_component(component index, type index, data, size),
+        // stops and returns false when the data is broken or a callback returns false
+        const auto walk_entities = [&](auto&& on_entity, auto&& on_component)
+        {
+            SnapshotReader walker = reader;
+            for(std::uint32_t entity_index=0; entity_index<entity_count; entity_index+=1)
+            {
+                EntityHandle handle;
+                EntityHandle parent;
+                std::uint32_t component_count = 0;
+                if(!walker.read(&handle) || !walker.read(&parent) || !walker.read(&component_count)) { return false; }
+                if(!on_entity(entity_index, handle, parent, component_count)) { return false; }
+                for(std::uint32_t component_index=0; component_index<component_count; component_index+=1)
+                {
+                    std::uint32_t type = 0;
+                    std::uint32_t size = 0;
+                    if(!walker.read(&type) || type >= saved_types.size() || !walker.read(&size)) { return false; }
+                    const unsigned char* data = walker.read_view(size);
+                    if(data == nullptr) { return false; }
+                    if(!on_component(component_index, type, data, size)) { return false; }
+                }
+            }
+            return walker.get_offset() == type_table;
+        };
+
+        // read the component from a view of the snapshot so a component can't read past its own data
+        const auto load_component = [&](Component* c, std::uint32_t type, const unsigned char* data, std::uint32_t size)
+        {
+            SnapshotReader component_reader(data, size);
+            return c->load(&component_reader, saved_types[type].schema_version);
+        };
+
+        // a rollback without structural changes has the same entities with the same components in the same order,
+        // load in place while that holds and fall back to matching the entities when it doesn't.
+        // Everything that was loaded before the mismatch is loaded again below
+        {
+            Entity* target = nullptr;
+            bool ok = true;
+            const bool same_layout = entity_count == entities.size() && walk_entities(
+                [&](std::uint32_t entity_index, EntityHandle handle, EntityHandle parent, std::uint32_t component_count)
+                {
+                    target = entities[entity_index].get();
+                    const EntityHandle current_parent = target->is_spatial_entity() ? target->root_component->parent : EntityHandle{};
+                    return target->handle == handle && current_parent == parent && target->components.size() == component_count;
+                },
+                [&](std::uint32_t component_index, std::uint32_t type, const unsigned char* data, std::uint32_t size)
+                {
+                    Component* c = target->components[component_index].get();
+                    if(c->type->name.hash != saved_types[type].hash) { return false; }
+                    ok = load_component(c, type, data, size) && ok;
+                    return true;
+                }
+            );
+            if(same_layout) { return ok; }
+        }
+
+        // parse everything first so a broken snapshot doesn't leave the world half restored
+        struct SavedComponent { std::uint32_t type; const unsigned char* data; std::uint32_t size; };
+        struct SavedEntity
+        {
+            EntityHandle handle;
+            EntityHandle parent;
+            std::size_t first_component;
+            std::size_t component_count;
+            Entity* target;
+        };
+        std::vector<SavedComponent> saved_components;
+        std::vector<SavedEntity> saved_entities;
+        saved_entities.reserve(entity_count);
+        const bool parsed = walk_entities(
+            [&](std::uint32_t, EntityHandle handle, EntityHandle parent, std::uint32_t component_count)
+            {
+                saved_entities.push_back({handle, parent, saved_components.size(), component_count, nullptr});
+                return true;
+            },
+            [&](std::uint32_t, std::uint32_t type, const unsigned char* data, std::uint32_t size)
+            {
+                saved_components.push_back({type, data, size});
+                return true;
+            }
+        );
+        if(parsed == false) { return false; }
+
+        // match the saved entities with the entities in this world, the rest is recreated
+        std::vector<bool> kept(entities.size(), false);
+
+        for(auto& saved: saved_entities)
+        {
+            const auto matches = [&](const Entity* ent)
+            {
+                if(ent->components.size() != saved.component_count) { return false; }
+                for(std::size_t index=0; index<saved.component_count; index+=1)
+                {
+                    const auto& component = saved_components[saved.first_component + index];
+                    if(ent->components[index]->type->name.hash != saved_types[component.type].hash) { return false; }
+                }
+                return true;
+            };
+
+            Entity* ent = resolve(saved.handle);
+            const bool in_world = ent != nullptr && ent->world_index < entities.size() && entities[ent->world_index].get() == ent;
+            if(in_world && kept[ent->world_index] == false && matches(ent))
+            {
+                saved.target = ent;
+                kept[ent->world_index] = true;
+                continue;
+            }
+
+            for(std::size_t index=0; index<saved.component_count; index+=1)
+            {
+                if(saved_types[saved_components[saved.first_component + index].type].type == nullptr) { return false; }
+            }
+        }
+
+        // no entities have been added or removed so far, from here on the world is changed to match the snapshot
+        std::vector<Entity*> to_destroy;
+        for(std::size_t index=0; index<entities.size(); index+=1)
+        {
+            if(kept[index] == false) { to_destroy.emplace_back(entities[index].get()); }
+        }
+        for(Entity* ent: to_destroy) { destroy(ent); }
+
+        for(auto& saved: saved_entities)
+        {
+            if(saved.target != nullptr) { continue; }
+
+            auto ent = std::make_unique<Entity>();
+            for(std::size_t index=0; index<saved.component_count; index+=1)
+            {
+                const ComponentType* type = saved_types[saved_components[saved.first_component + index].type].type;
+                ComponentPtr c = type->create();
+                if(type == &spatial_component_type && ent->root_component == nullptr)
+                {
+                    ent->root_component = static_cast<SpatialComponent*>(c.get());
+                }
+                ent->components.emplace_back(std::move(c));
+            }
+            saved.target = add(std::move(ent));
+        }
+
+        // attach before loading so the loaded global transforms aren't overwritten by attach,
+        // all changed entities are detached first so a swapped parent and child never form a cycle
+        std::unordered_map<std::uint32_t, const SavedEntity*> saved_from_index;
+        for(const auto& saved: saved_entities) { saved_from_index.emplace(saved.handle.index, &saved); }
+
+        std::vector<std::pair<Entity*, Entity*>> to_attach;
+        for(auto& saved: saved_entities)
+        {
+            Entity* ent = saved.target;
+            if(ent->is_spatial_entity() == false) { continue; }
+
+            Entity* parent = nullptr;
+            if(const auto found = saved_from_index.find(saved.parent.index); found != saved_from_index.end() && found->second->handle == saved.parent)
+            {
+                parent = found->second->target;
+            }
+            if(parent != nullptr && parent->is_spatial_entity() == false) { parent = nullptr; }
+
+            if(resolve(ent->root_component->parent) == parent) { continue; }
+            detach(ent);
+            if(parent != nullptr) { to_attach.emplace_back(parent, ent); }
+        }
+        for(const auto& [parent, child]: to_attach)
+        {
+            attach(this, parent->handle, child->handle);
+        }
+
+        bool ok = true;
+        for(const auto& saved: saved_entities)
+        {
+            for(std::size_t index=0; index<saved.component_count; index+=1)
+            {
+                const auto& component = saved_components[saved.first_component + index];
+                ok = load_component(saved.target->components[index].get(), component.type, component.data, component.size) && ok;
+            }
+        }
+
+        return ok;
+    }
+
+    void World::set_deferred_transforms(bool deferred)
+    {
+        if(deferred_transforms == deferred) { return; }
+        deferred_transforms = deferred;
+        if(deferred)
+        {
+            // the hierarchy is created together with the update chains
+            update_chains_dirty = true;
+        }
+        else
+        {
+            transforms.clear();
+        }
+    }
+
+    void World::build_update_chains()
+    {
+        struct Sortable
+        {
+            Entity* entity;
+            std::size_t chain;
+            std::size_t depth;
+        };
+
+        // find spatial root and depth for each entity, chains are numbered in the order the root is found
+        std::unordered_map<Entity*, std::size_t> chain_from_root;
+        std::vector<std::uint32_t> root_of; // handle index of the root for each chain
+        std::vector<Sortable> sortable;
+        sortable.reserve(entities.size());
+        for(auto& ent: entities)
+        {
+            Entity* root = ent.get();
+            std::size_t depth = 0;
+            while(root->is_spatial_entity())
+            {
+                // a destroyed parent makes this a root
+                Entity* parent = resolve(root->root_component->get_parent());
+                if(parent == nullptr) { break; }
+                root = parent;
+                depth += 1;
+            }
+            const auto [found, inserted] = chain_from_root.try_emplace(root, chain_from_root.size());
+            if(inserted) { root_of.emplace_back(root->handle.index); }
+            sortable.push_back({ent.get(), found->second, depth});
+        }
+
+        std::stable_sort(sortable.begin(), sortable.end(), [](const Sortable& lhs, const Sortable& rhs)
+        {
+            if(lhs.chain != rhs.chain) { return lhs.chain < rhs.chain; }
+            return lhs.depth < rhs.depth;
+        });
+
+        for(const auto& e: sortable)
+        {
+            const std::uint64_t root_index = root_of[e.chain];
+            e.entity->update_key = (root_index << 32) | static_cast<std::uint64_t>(e.depth);
+        }
+
+        update_order.clear();
+        for(const auto& e: sortable)
+        {
+            update_order.emplace_back(e.entity);
+        }
+
+        if(deferred_transforms)
+        {
+            transforms.rebuild(update_order);
+        }
+
+        update_plan.rebuild(update_order);
+        update_plan_dirty = false;
+        update_chains_dirty = false;
+    }
+
+    void World::set_points_of_interest(std::vector<core::vec3f> points)
+    {
+        points_of_interest = std::move(points);
+    }
+
+    void World::set_tier_distances(float every_2nd_frame, float every_4th_frame, float dormant)
+    {
+        assert(every_2nd_frame <= every_4th_frame && every_4th_frame <= dormant);
+        tier_distances = {every_2nd_frame, every_4th_frame, dormant};
+    }
+
+    UpdateTier World::get_wanted_tier(const Entity* root) const
+    {
+        if(root->automatic_tier == false || root->is_spatial_entity() == false || points_of_interest.empty())
+        {
+            return root->automatic_tier ? UpdateTier::every_frame : root->tier;
+        }
+
+        const core::mat4f& m = root->root_component->get_global_transform();
+        float closest = std::numeric_limits<float>::max();
+        for(const auto& p: points_of_interest)
+        {
+            const float x = m.m[12] - p.x;
+            const float y = m.m[13] - p.y;
+            const float z = m.m[14] - p.z;
+            closest = std::min(closest, x*x + y*y + z*z);
+        }
+
+        if(closest < tier_distances[0] * tier_distances[0]) { return UpdateTier::every_frame; }
+        if(closest < tier_distances[1] * tier_distances[1]) { return UpdateTier::every_2nd_frame; }
+        if(closest < tier_distances[2] * tier_distances[2]) { return UpdateTier::every_4th_frame; }
+        return UpdateTier::dormant;
+    }
+
+    std::uint8_t World::pick_target_slot(std::uint8_t current_slot, UpdateTier tier) const
+    {
+        const std::uint32_t period = get_update_period(tier);
+        if(period == 0) { return dormant_update_slot; }
+
+        // to keep the dt correct the entity can only move on a frame where both the current and the target slot is updated,
+        // so the phase must match the current phase on the shorter period
+        const std::uint32_t current_period = get_update_slot_period(current_slot);
+        const std::uint32_t step = current_period == 0 ? 1 : std::min(period, current_period);
+        const std::uint32_t first_phase = current_period == 0 ? 0 : get_update_slot_phase(current_slot) % step;
+
+        std::uint8_t best = get_update_slot(period, first_phase);
+        for(std::uint32_t phase=first_phase; phase<period; phase+=step)
+        {
+            const std::uint8_t slot = get_update_slot(period, phase);
+            if(slot_load[slot] < slot_load[best]) { best = slot; }
+        }
+        return best;
+    }
+
+    void World::update_tiers()
+    {
+        for(std::size_t begin=0; begin<update_order.size();)
+        {
+            // a chain is the root followed by all attached entities
+            Entity* root = update_order[begin];
+            std::size_t end = begin + 1;
+            while(end < update_order.size() && (update_order[end]->update_key >> 32) == (root->update_key >> 32)) { end += 1; }
+
+            const UpdateTier tier = get_wanted_tier(root);
+            const std::uint8_t target = get_update_period(tier) == get_update_slot_period(root->target_update_slot)
+                ? root->target_update_slot
+                : pick_target_slot(root->update_slot, tier);
+
+            // moving between two slots that are due this frame keeps the accumulated dt of both correct
+            const auto can_move = [this](std::uint8_t from, std::uint8_t to)
+            {
+                return from == dormant_update_slot || to == dormant_update_slot
+                    || (update_plan.is_due(from) && update_plan.is_due(to));
+            };
+
+            const std::uint8_t current = root->update_slot;
+            const std::uint8_t slot = can_move(current, target) ? target : current;
+
+            for(std::size_t index=begin; index<end; index+=1)
+            {
+                Entity* ent = update_order[index];
+                slot_load[ent->target_update_slot] -= 1;
+                slot_load[target] += 1;
+                ent->target_update_slot = target;
+
+                // attached entities follow the root, a newly attached entity can be in another slot than the root
+                if(ent->update_slot == slot || can_move(ent->update_slot, slot) == false) { continue; }
+                ent->update_slot = slot;
+                update_plan_dirty = true;
+            }
+
+            begin = end;
+        }
+    }
+
+    void World::update(UpdateStage stage, float dt)
+    {
+        PROFILE_SCOPE(to_string(stage));
+        WorldCommands::Scope commands_scope(&get_commands());
+
+        if(stage == UpdateStage::start_frame)
+        {
+            update_plan.begin_frame(dt);
+            update_loading();
+        }
+
+        if(update_chains_dirty)
+        {
+            build_update_chains();
+        }
+        else if(update_plan_dirty)
+        {
+            update_plan.rebuild(update_order);
+            update_plan_dirty = false;
+        }
+
+        // parallelized, spatial parent is updated before child (worker threads: nuber of cores - 1)
+        // every depth is a group that waits for the previous, so a parent is done before the child updates on any thread
+        update_plan.update(stage, workers.get(), commands.data());
+
+        if(stage == UpdateStage::end_frame)
+        {
+            dead_components.advance_frame();
+            dead_entities.advance_frame();
+        }
+
+        // once per stage if any transform was changed
+        if(deferred_transforms && transforms.is_dirty())
+        {
+            transforms.update();
+        }
+        spatial_index.update();
+
+        // after the transforms so the distances are from this frame, and after all updates so the slot dt stay correct
+        if(stage == UpdateStage::end_frame)
+        {
+            update_tiers();
+        }
+        
+        // todo(Gustav): implement threading for world
+        // sequential, can use worker threads if needed
+        system_update.update(stage);
+
+        // structural changes are never made while systems are iterating
+        play_back_commands();
+    }
+
+
+    
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // Examples
+#if 0
+    namespace example
+    {
+        struct Skeleton {};
+        struct Pose {};
+
+        struct AnimationGraphComponent
+        {
+            Skeleton* skeleton;
+            Pose calc_pose();
+        };
+        struct SkeletalMeshComponent
+        {
+            // property: MeshResource(defines skeleton, bindpose, inverse bindpose)
+            // init/shutdown: allocate pose storage based on mesh
+
+            Skeleton* skeleton;
+            void set_pose(const Pose& pose);
+        };
 
-        /*
-        design thought: who removes this from the update list when it's destroyed?
-        better to return a register request and let the caller add/remove stages+prios to the update list?
+        /** Example demonstrating a EnitySystem.
+         * * Animation system is repsonsible for executing animation tasks and trasferring
+         * the results to the skeletal mesh component
+         * * Domain specific logic sis kept within the indivual components
+         * * The logic for what updates and what data to transfer is in the system.
         */
-        virtual void register_updates(EntitySystemUpdate* updates) = 0;
+        struct SimpleSingleAnimationSystem : EntitySystem
+        {
+            AnimationGraphComponent* animation_graph;
+            SkeletalMeshComponent* mesh;
 
-        /// Called by EntitySystemUpdate
-        virtual void update(UpdateStage stage) = 0;
+            void update(UpdateStage) override
+            {
+                if(animation_graph->skeleton == mesh->skeleton)
+                {
+                    mesh->set_pose(animation_graph->calc_pose());
+                }
+            }
+        };
 
-        /*
-        design thoughts:
-        should we get a callback for each component, or a general... here is a the latest state of the components you care about
-        current setup is probably easier to implement but requirements could be different from actual usage
+        /// can have multiple meshes, or let the animationgraph return multiple poses/skeletons (custmization system)
+        struct SimpleMultiAnimationSystem : EntitySystem
+        {
+            AnimationGraphComponent* animation_graph;
+            std::vector<SkeletalMeshComponent*> meshes;
 
-        keep in mind that the system is per entity so it's just getting references to components and storing them as member variables
-        */
+            void update(UpdateStage) override
+            {
+                auto pose = animation_graph->calc_pose();
+                for(SkeletalMeshComponent* mesh: meshes)
+                {
+                    if(animation_graph->skeleton == mesh->skeleton)
+                    {
+                        mesh->set_pose(pose);
+                    }
+                }
+            }
+        };
+    }
+#endif
+}
 
-        /// a component was added or activated on the entity
-        virtual void component_was_added(Component* c) = 0;
 
-        /// a component was removed or deactivated on the entity
-        virtual void component_was_removed(Component* c) = 0;
-    };
 
 
-    struct EntitySystemType
-    {
-        core::HashedStringView name;
+///////////////////////////////////////////////////////////////////////////////////////////////
+// Benchmarks
+// run with `entity bench` for all or `entity bench <name>` for a single one
 
-        EntitySystemType(core::HashedStringView);
-        virtual ~EntitySystemType() = default;
+namespace bench
+{
+    using namespace entity;
+
+    struct Timer
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-        virtual std::unique_ptr<EntitySystem> create() = 0;
+        double get_ms() const
+        {
+            const auto now = std::chrono::steady_clock::now();
+            return std::chrono::duration<double, std::milli>(now - start).count();
+        }
     };
 
-    struct EntitySystemFactory
+    /// prevent the optimizer from removing the benchmarked work
+    volatile float sink = 0.0f;
+
+    constexpr float frame_dt = 1.0f / 60.0f;
+
+    /// a entity system that does a bit of busy work so there is something to schedule
+    struct BusySystem : EntitySystem
     {
-        void add(const EntitySystemType* ny);
-        const EntitySystemType* from_name_or_null(core::HashedStringView name);
+        float value = 0.0f;
 
-    private:
-        std::unordered_map<core::HashedStringView, const EntitySystemType*> types;
+        /// sum of dt and number of updates in before_physics
+        double total_time = 0.0;
+        std::size_t update_count = 0;
+
+        RequestedComponents get_component_requests() override { return {}; }
+
+        void register_updates(EntitySystemUpdate* updates) override
+        {
+            updates->add(this, UpdateStage::before_physics, 0);
+            updates->add(this, UpdateStage::after_physics, 0);
+        }
+
+        void update(UpdateStage stage, float dt) override
+        {
+            if(stage == UpdateStage::before_physics)
+            {
+                total_time += dt;
+                update_count += 1;
+            }
+            for(int i=0; i<64; i+=1)
+            {
+                value = std::sin(value + static_cast<float>(i));
+            }
+        }
+
+        void component_was_added(Component*) override {}
+        void component_was_removed(Component*) override {}
     };
 
+    const EntitySystemTypeOf<BusySystem> bench_busy_system_type{"bench-busy"};
 
-    /*
-    Design thoughts: should we have a single instance or a per-entity instance.
-    Currently it's written as a per-entity instance.
+    void world_update()
+    {
+        constexpr std::size_t entity_count = 20000;
+        constexpr std::size_t frame_count = 20;
+
+        // every 8th entity is a root, the rest is attached in a chain below it
+        World world;
+        std::vector<BusySystem*> entity_systems;
+        Entity* previous = nullptr;
+        for(std::size_t index=0; index<entity_count; index+=1)
+        {
+            auto spatial = spatial_component_type.create();
+            auto ent = std::make_unique<Entity>();
+            ent->root_component = static_cast<SpatialComponent*>(spatial.get());
+            ent->components.emplace_back(std::move(spatial));
+
+            auto sys = bench_busy_system_type.create();
+            entity_systems.emplace_back(static_cast<BusySystem*>(sys.get()));
+            ent->local_systems.emplace_back(std::move(sys));
+
+            Entity* added = world.add(std::move(ent));
+            if(index % 8 != 0) { attach(&world, previous->handle, added->handle); }
+            previous = added;
+        }
 
-    Pro:
-    * Simpler
-    * We can be sure it's thread safe as it won't integrate with other streads
+        const auto max_workers = std::max<std::size_t>(core::default_worker_count(), 1);
+        for(std::size_t workers=0; workers<=max_workers; workers = workers == 0 ? 1 : workers*2)
+        {
+            world.set_worker_count(workers);
+            world.update(UpdateStage::start_frame, frame_dt); // warmup and build chains
 
-    Cons:
-    * Ugly
-    * Wastes memory as we need a instance of the system per entity
+            Timer timer;
+            for(std::size_t frame=0; frame<frame_count; frame+=1)
+            {
+                for(unsigned int stage=0; stage<UpdateStageCount; stage+=1)
+                {
+                    world.update(static_cast<UpdateStage>(stage), frame_dt);
+                }
+            }
+            std::printf("  %2zu workers: %8.3f ms/frame\n", workers, timer.get_ms() / frame_count);
+        }
 
+        for(auto& sys: entity_systems) { sink = sink + sys->value; }
 
-    */
+#if ENTITY_PROFILER
+        core::Profiler::write_chrome_trace("world-update-trace.json");
+        core::Profiler::write_summary("world-update-summary.csv");
+        core::Profiler::print_summary();
+        std::printf("  wrote world-update-trace.json and world-update-summary.csv\n");
+#endif
+    }
 
-    /** A global system for the world.
-     * 
-     * Only one system of a specified type is allowed per world
-     * 
-     * Primary role is to handle global world state.
-     * Secondary role is to do data transfer between entitites.
-     * 
-     * 
-     * Examples:
-     *  * skeletal mesh
-     *  * physics
-     *  * static mesh
-     *  * navmesh
-     * 
-     * @todo Add types similar to ComponentType and ComponentFactory
-    */
-    struct WorldSystem
+    void world_update_tiers()
     {
-        virtual void register_updates(WorldSystemUpdate* updates) = 0;
+        constexpr std::size_t entity_count = 20000;
+        constexpr std::size_t frame_count = 64;
+
+        // entities on a line away from the point of interest, in chains of 4 so the tiers follow the root
+        World world;
+        world.set_tier_distances(2500.0f, 5000.0f, 10000.0f);
+        std::vector<BusySystem*> entity_systems;
+        std::vector<Entity*> system_entities;
+        Entity* previous = nullptr;
+        for(std::size_t index=0; index<entity_count; index+=1)
+        {
+            auto spatial = spatial_component_type.create();
+            auto ent = std::make_unique<Entity>();
+            ent->root_component = static_cast<SpatialComponent*>(spatial.get());
+            ent->components.emplace_back(std::move(spatial));
+
+            auto sys = bench_busy_system_type.create();
+            entity_systems.emplace_back(static_cast<BusySystem*>(sys.get()));
+            ent->local_systems.emplace_back(std::move(sys));
+
+            Entity* added = world.add(std::move(ent));
+            system_entities.emplace_back(added);
+            core::mat4f m;
+            m.m[12] = static_cast<float>(index) * 0.6f;
+            added->root_component->set_local_transform(m);
+            if(index % 4 != 0) { attach(&world, previous->handle, added->handle); }
+            previous = added;
+        }
 
-        /*
-        Design thought: if this is used to transfer data between components,
-        should there be some ui hint system similar to get_component_requests?
-        */
+        const auto run_frames = [&](const char* name)
+        {
+            for(auto* sys: entity_systems) { sys->total_time = 0.0; sys->update_count = 0; }
 
-        /// Called by WorldSystemUpdate
-        virtual void update(UpdateStage stage) = 0;
+            // the time that was pending when the run started is given in the first update
+            std::vector<double> start_pending(system_entities.size());
+            for(std::size_t index=0; index<system_entities.size(); index+=1)
+            {
+                start_pending[index] = world.get_pending_time(system_entities[index]);
+            }
 
-        virtual void system_was_added_to_world() = 0;
-        virtual void system_was_removed_from_world() = 0;
+            double min_ms = std::numeric_limits<double>::max();
+            double max_ms = 0.0;
+            Timer total;
+            for(std::size_t frame=0; frame<frame_count; frame+=1)
+            {
+                Timer timer;
+                for(unsigned int stage=0; stage<UpdateStageCount; stage+=1)
+                {
+                    world.update(static_cast<UpdateStage>(stage), frame_dt);
+                }
+                min_ms = std::min(min_ms, timer.get_ms());
+                max_ms = std::max(max_ms, timer.get_ms());
+            }
 
-        /// a component was added or activated on a entity
-        virtual void component_was_added(Entity* ent, Component* c) = 0;
+            // systems that are updating should have been given all the time except what's still accumulating
+            std::size_t updates = 0;
+            double max_error = 0.0;
+            const double elapsed = static_cast<double>(frame_count) * frame_dt;
+            for(std::size_t index=0; index<entity_systems.size(); index+=1)
+            {
+                const BusySystem* sys = entity_systems[index];
+                updates += sys->update_count;
+                if(sys->update_count < frame_count / 4) { continue; }
+                const double given = start_pending[index] + elapsed - world.get_pending_time(system_entities[index]);
+                max_error = std::max(max_error, std::abs(given - sys->total_time));
+            }
+            std::printf("  %-12s %8.3f ms/frame (min %.3f, max %.3f), %7.1f updates/frame, max dt error %.4f s\n",
+                name, total.get_ms() / frame_count, min_ms, max_ms,
+                static_cast<double>(updates) / frame_count, max_error);
+        };
 
-        /// a component was removed or deactivated on a entity
-        virtual void component_was_removed(Entity* ent, Component* c) = 0;
-    };
+        run_frames("no tiers");
 
-    struct WorldSystemType
+        // let the entities settle in their slots before measuring
+        world.set_points_of_interest({core::vec3f{0.0f, 0.0f, 0.0f}});
+        for(std::size_t frame=0; frame<8; frame+=1)
+        {
+            for(unsigned int stage=0; stage<UpdateStageCount; stage+=1)
+            {
+                world.update(static_cast<UpdateStage>(stage), frame_dt);
+            }
+        }
+        run_frames("tiers");
+
+        for(auto& sys: entity_systems) { sink = sink + sys->value; }
+    }
+
+    struct BenchPosition : Component
     {
-        core::HashedStringView name;
+        float x = 0.0f; float y = 0.0f; float z = 0.0f;
+        float vx = 1.0f; float vy = 2.0f; float vz = 3.0f;
 
-        WorldSystemType(core::HashedStringView);
-        virtual ~WorldSystemType() = default;
+        void save(SnapshotWriter* writer) const override
+        {
+            const float data[6] = {x, y, z, vx, vy, vz};
+            writer->write(data);
+        }
 
-        virtual std::unique_ptr<WorldSystem> create() = 0;
+        bool load(SnapshotReader* reader, std::uint32_t) override
+        {
+            float data[6];
+            if(reader->read(&data) == false) { return false; }
+            x = data[0]; y = data[1]; z = data[2];
+            vx = data[3]; vy = data[4]; vz = data[5];
+            return true;
+        }
     };
-
-    struct WorldSystemFactory
+    struct BenchHealth : Component
     {
-        void add(const WorldSystemType* ty);
-        const WorldSystemType* from_name_or_null(core::HashedStringView name);
+        float health = 100.0f;
 
-    private:
-        std::unordered_map<core::HashedStringView, const WorldSystemType*> types;
+        void save(SnapshotWriter* writer) const override { writer->write(health); }
+        bool load(SnapshotReader* reader, std::uint32_t) override { return reader->read(&health); }
     };
+    const ComponentTypeOf<BenchPosition> bench_position_type{"bench-position"};
+    const ComponentTypeOf<BenchHealth> bench_health_type{"bench-health"};
 
-    struct WorldSystemWithPrio
+    void archetype_iteration()
     {
-        WorldSystemWithPrio(WorldSystem* s, int p);
+        constexpr std::size_t entity_count = 100000;
+        constexpr std::size_t iteration_count = 20;
+        constexpr float dt = 1.0f / 60.0f;
+
+        std::vector<std::unique_ptr<Entity>> pointer_entities;
+        std::vector<std::unique_ptr<Entity>> archetype_entities;
+        ArchetypeStorage storage;
+        for(std::size_t index=0; index<entity_count; index+=1)
+        {
+            auto& ent = pointer_entities.emplace_back(std::make_unique<Entity>());
+            ent->components.emplace_back(bench_health_type.create());
+            ent->components.emplace_back(bench_position_type.create());
 
-        WorldSystem* system;
-        int prio;
+            auto& arch = archetype_entities.emplace_back(std::make_unique<Entity>());
+            storage.add(arch.get(), {&bench_health_type, &bench_position_type});
+        }
+
+        {
+            Timer timer;
+            for(std::size_t iteration=0; iteration<iteration_count; iteration+=1)
+            {
+                for(auto& ent: pointer_entities)
+                {
+                    for(auto& c: ent->components)
+                    {
+                        if(c->type != &bench_position_type) { continue; }
+                        auto* p = static_cast<BenchPosition*>(c.get());
+                        p->x += p->vx * dt; p->y += p->vy * dt; p->z += p->vz * dt;
+                    }
+                }
+            }
+            std::printf("  unique_ptr: %8.3f ms/iteration\n", timer.get_ms() / iteration_count);
+        }
+
+        {
+            Timer timer;
+            for(std::size_t iteration=0; iteration<iteration_count; iteration+=1)
+            {
+                storage.for_each_chunk<BenchPosition>({&bench_position_type}, [](ColumnSpan<BenchPosition> positions)
+                {
+                    for(auto& p: positions)
+                    {
+                        p.x += p.vx * dt; p.y += p.vy * dt; p.z += p.vz * dt;
+                    }
+                });
+            }
+            std::printf("  archetype:  %8.3f ms/iteration\n", timer.get_ms() / iteration_count);
+        }
+
+        for(auto& ent: archetype_entities) { storage.remove(ent.get()); }
+    }
+
+    struct BenchProjectile : Component
+    {
+        float position[3] = {0.0f, 0.0f, 0.0f};
+        float velocity[3] = {0.0f, 0.0f, 0.0f};
     };
+    const ComponentTypeOf<BenchProjectile> bench_projectile_type{"bench-projectile", false};
 
-    struct WorldSystemUpdateStageList
+    void component_pool()
     {
-        void update(UpdateStage stage);
-        void add(WorldSystem* sys, int prio);
-        void remove(WorldSystem* sys);
+        constexpr std::size_t frame_count = 300;
+        constexpr std::size_t spawns_per_frame = 500;
+        constexpr std::size_t lifetime = 30;
+
+        // spawn projectiles every frame and kill them after a while
+        Entity ent;
+        ReclaimRing<ComponentPtr> dead;
+        std::size_t spawned = 0;
+        Timer timer;
+        for(std::size_t frame=0; frame<frame_count; frame+=1)
+        {
+            if(frame % lifetime == 0)
+            {
+                for(auto& c: ent.components) { dead.retire(std::move(c)); }
+                ent.components.clear();
+            }
+            for(std::size_t index=0; index<spawns_per_frame; index+=1)
+            {
+                ent.components.emplace_back(bench_projectile_type.create());
+                spawned += 1;
+            }
+            dead.advance_frame();
+        }
+        const double ms = timer.get_ms();
 
-    private:
-        std::vector<WorldSystemWithPrio> systems;
-    };
+        const auto stats = bench_projectile_type.get_allocation_stats();
+        std::printf("  %zu components spawned in %.3f ms\n", spawned, ms);
+        std::printf("  pool: %zu allocations, %zu frees in %zu batches\n", stats.allocations, stats.frees, stats.batch_frees);
+        std::printf("  heap: %zu allocations (%zu without the pool)\n", stats.slab_allocations, stats.allocations);
+    }
 
-    /** Updates WorldSystem.
-    */
-    struct WorldSystemUpdate
+    void world_snapshot()
     {
-        void update(UpdateStage);
+        constexpr std::size_t entity_count = 50000;
+        constexpr std::size_t iteration_count = 20;
 
-        void add(WorldSystem*, UpdateStage, int prio);
-        void remove(WorldSystem*, UpdateStage stage);
+        World world;
+        for(std::size_t index=0; index<entity_count; index+=1)
+        {
+            auto ent = std::make_unique<Entity>();
+            auto spatial = spatial_component_type.create();
+            ent->root_component = static_cast<SpatialComponent*>(spatial.get());
+            ent->components.emplace_back(std::move(spatial));
+            ent->components.emplace_back(bench_position_type.create());
+            ent->components.emplace_back(bench_health_type.create());
+            world.add(std::move(ent));
+        }
 
-    private:
-        std::array<WorldSystemUpdateStageList, UpdateStageCount> systems;
-    };
+        Snapshot snapshot;
+        world.save_snapshot(&snapshot); // warmup so the buffer is allocated
+        const double mb = static_cast<double>(snapshot.data.size()) / (1024.0 * 1024.0);
+
+        {
+            Timer timer;
+            for(std::size_t iteration=0; iteration<iteration_count; iteration+=1)
+            {
+                world.save_snapshot(&snapshot);
+            }
+            const double ms = timer.get_ms() / iteration_count;
+            std::printf("  snapshot: %8.3f ms, %8.1f MB/s (%.2f MB)\n", ms, mb / (ms / 1000.0), mb);
+        }
+
+        {
+            Timer timer;
+            bool ok = true;
+            for(std::size_t iteration=0; iteration<iteration_count; iteration+=1)
+            {
+                ok = world.restore_snapshot(snapshot) && ok;
+            }
+            const double ms = timer.get_ms() / iteration_count;
+            std::printf("  restore:  %8.3f ms, %8.1f MB/s%s\n", ms, mb / (ms / 1000.0), ok ? "" : " FAILED");
+        }
+    }
+
+    /// a camera at eye looking down -z
+    core::Frustum make_bench_frustum(const core::vec3f& eye, float far_distance)
+    {
+        const float near_distance = 0.1f;
+        const float f = 1.0f / std::tan(0.5f * 1.0f); // ~57 degree fov
+        core::mat4f projection;
+        projection.m[0] = f;
+        projection.m[5] = f;
+        projection.m[10] = (far_distance + near_distance) / (near_distance - far_distance);
+        projection.m[11] = -1.0f;
+        projection.m[14] = 2.0f * far_distance * near_distance / (near_distance - far_distance);
+        projection.m[15] = 0.0f;
+
+        core::mat4f view;
+        view.m[12] = -eye.x;
+        view.m[13] = -eye.y;
+        view.m[14] = -eye.z;
+        return core::make_frustum(projection * view);
+    }
+
+    void spatial_query()
+    {
+        constexpr std::size_t frustum_count = 16;
+        constexpr std::size_t sphere_count = 128;
+        constexpr std::size_t ray_count = 128;
+
+        core::WorkerPool workers{core::default_worker_count()};
+
+        for(const std::size_t object_count: {std::size_t{10000}, std::size_t{100000}, std::size_t{1000000}})
+        {
+            // same density regardless of count
+            const float size = 4.0f * std::cbrt(static_cast<float>(object_count));
+            std::mt19937 rng{42};
+            std::uniform_real_distribution<float> position{0.0f, size};
+            std::uniform_real_distribution<float> extent{0.1f, 1.0f};
+            const auto random_point = [&]() { return core::vec3f{position(rng), position(rng), position(rng)}; };
+
+            std::vector<core::Aabb> boxes(object_count);
+            for(auto& box: boxes)
+            {
+                const auto p = random_point();
+                const auto e = extent(rng);
+                box = {{p.x - e, p.y - e, p.z - e}, {p.x + e, p.y + e, p.z + e}};
+            }
+
+            std::vector<core::Frustum> frustums;
+            std::vector<core::Sphere> spheres;
+            std::vector<core::Ray> rays;
+            for(std::size_t index=0; index<frustum_count; index+=1) { frustums.emplace_back(make_bench_frustum(random_point(), 30.0f)); }
+            for(std::size_t index=0; index<sphere_count; index+=1) { spheres.emplace_back(core::Sphere{random_point(), 8.0f}); }
+            for(std::size_t index=0; index<ray_count; index+=1)
+            {
+                const auto d = random_point();
+                const float half = size * 0.5f;
+                const float length = std::sqrt((d.x-half)*(d.x-half) + (d.y-half)*(d.y-half) + (d.z-half)*(d.z-half));
+                rays.emplace_back(core::Ray{random_point(), {(d.x-half)/length, (d.y-half)/length, (d.z-half)/length}, size * 0.5f});
+            }
+
+            core::DynamicBvh bvh{0.1f};
+            std::vector<std::uint32_t> proxies(object_count);
+            double build_ms = 0.0;
+            {
+                Timer timer;
+                for(std::size_t index=0; index<object_count; index+=1)
+                {
+                    proxies[index] = bvh.add(boxes[index], static_cast<std::uint32_t>(index));
+                }
+                build_ms = timer.get_ms();
+            }
+
+            // move a tenth of the objects a little, most stay inside the enlarged boxes
+            double refit_ms = 0.0;
+            std::size_t reinserted = 0;
+            {
+                std::uniform_real_distribution<float> offset{-0.05f, 0.05f};
+                Timer timer;
+                for(std::size_t index=0; index<object_count; index+=10)
+                {
+                    const core::vec3f o = {offset(rng), offset(rng), offset(rng)};
+                    auto& box = boxes[index];
+                    box = {{box.min.x + o.x, box.min.y + o.y, box.min.z + o.z}, {box.max.x + o.x, box.max.y + o.y, box.max.z + o.z}};
+                    if(bvh.move(proxies[index], box)) { reinserted += 1; }
+                }
+                refit_ms = timer.get_ms();
+            }
+            std::printf("  %zu objects: build %.3f ms, height %d, moved %zu in %.3f ms (%zu reinserted)\n",
+                object_count, build_ms, bvh.get_height(), object_count / 10, refit_ms, reinserted);
+
+            const auto compare = [&](const char* name, std::size_t query_count, auto&& brute_test, auto&& bvh_query)
+            {
+                std::vector<std::size_t> brute_hits(query_count, 0);
+                std::vector<std::size_t> bvh_hits(query_count, 0);
+
+                Timer brute_timer;
+                for(std::size_t query=0; query<query_count; query+=1)
+                {
+                    for(const auto& box: boxes)
+                    {
+                        if(brute_test(query, box)) { brute_hits[query] += 1; }
+                    }
+                }
+                const double brute_ms = brute_timer.get_ms();
 
-    struct World
-    {
-        void update(UpdateStage s);
+                Timer bvh_timer;
+                for(std::size_t query=0; query<query_count; query+=1)
+                {
+                    bvh_query(query, [&bvh_hits, query](std::uint32_t) { bvh_hits[query] += 1; });
+                }
+                const double bvh_ms = bvh_timer.get_ms();
 
-    private:
-        std::vector<std::unique_ptr<Entity>> entities;
-        std::vector<std::unique_ptr<WorldSystem>> systems;
-        WorldSystemUpdate system_update;
-    };
+                // batched, one query per job
+                std::vector<std::size_t> batch_hits(query_count, 0);
+                Timer batch_timer;
+                workers.run(query_count, [&](std::size_t query)
+                {
+                    bvh_query(query, [&batch_hits, query](std::uint32_t) { batch_hits[query] += 1; });
+                });
+                const double batch_ms = batch_timer.get_ms();
+
+                std::size_t total = 0;
+                for(const auto hits: bvh_hits) { total += hits; }
+                const bool match = brute_hits == bvh_hits && bvh_hits == batch_hits;
+                std::printf("    %-8s brute %9.3f ms, bvh %8.3f ms, batched %8.3f ms, %7.1f hits/query%s\n",
+                    name, brute_ms, bvh_ms, batch_ms, static_cast<double>(total) / static_cast<double>(query_count), match ? "" : " MISMATCH");
+            };
+
+            compare("frustum", frustum_count,
+                [&](std::size_t q, const core::Aabb& box) { return core::classify(frustums[q], box) != core::Containment::outside; },
+                [&](std::size_t q, auto&& on_hit) { bvh.query(frustums[q], on_hit); });
+            compare("sphere", sphere_count,
+                [&](std::size_t q, const core::Aabb& box) { return core::intersects(spheres[q], box); },
+                [&](std::size_t q, auto&& on_hit) { bvh.query(spheres[q], on_hit); });
+
+            std::vector<core::vec3f> inverse_directions;
+            for(const auto& ray: rays) { inverse_directions.push_back({1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z}); }
+            compare("ray", ray_count,
+                [&](std::size_t q, const core::Aabb& box) { return core::intersects(rays[q], inverse_directions[q], box); },
+                [&](std::size_t q, auto&& on_hit) { bvh.query(rays[q], on_hit); });
+        }
+    }
 
+    void world_query()
+    {
+        constexpr std::size_t entity_count = 100000;
+        constexpr std::size_t iteration_count = 20;
 
+        // every entity has a position, every other a health
+        World world;
+        std::vector<Entity*> all_entities;
+        for(std::size_t index=0; index<entity_count; index+=1)
+        {
+            auto ent = std::make_unique<Entity>();
+            ent->components.emplace_back(bench_position_type.create());
+            if(index % 2 == 0) { ent->components.emplace_back(bench_health_type.create()); }
+            all_entities.emplace_back(world.add(std::move(ent)));
+        }
 
+        Timer create_timer;
+        const auto query = world.query<Required<BenchPosition, BenchHealth>>({&bench_position_type, &bench_health_type});
+        const double create_ms = create_timer.get_ms();
 
+        const auto integrate = [](Entity&, BenchPosition& p, BenchHealth& h)
+        {
+            p.x += p.vx * frame_dt;
+            p.y += p.vy * frame_dt;
+            p.z += p.vz * frame_dt;
+            h.health -= 0.01f;
+        };
 
-    ///////////////////////////////////////////////////////////////////////////////////////////////
-    // Implementations
+        // what a system does without a query: look at every entity and search the components
+        double scan_ms = 0.0;
+        {
+            Timer timer;
+            for(std::size_t iteration=0; iteration<iteration_count; iteration+=1)
+            {
+                for(Entity* ent: all_entities)
+                {
+                    BenchPosition* p = nullptr;
+                    BenchHealth* h = nullptr;
+                    for(auto& c: ent->components)
+                    {
+                        if(c->type == &bench_position_type) { p = static_cast<BenchPosition*>(c.get()); }
+                        else if(c->type == &bench_health_type) { h = static_cast<BenchHealth*>(c.get()); }
+                    }
+                    if(p != nullptr && h != nullptr) { integrate(*ent, *p, *h); }
+                }
+            }
+            scan_ms = timer.get_ms() / iteration_count;
+        }
 
-    void Alive::kill()
-    {
-        if(health == 0)
+        double query_ms = 0.0;
         {
-            health = 1;
+            Timer timer;
+            for(std::size_t iteration=0; iteration<iteration_count; iteration+=1)
+            {
+                query.for_each(integrate);
+            }
+            query_ms = timer.get_ms() / iteration_count;
         }
-    }
 
-    void Alive::update_for_frame()
-    {
-        if(health > 0)
+        double parallel_ms = 0.0;
         {
-            health += 1;
+            Timer timer;
+            for(std::size_t iteration=0; iteration<iteration_count; iteration+=1)
+            {
+                query.for_each_parallel(world.get_workers(), 1024, integrate);
+            }
+            parallel_ms = timer.get_ms() / iteration_count;
         }
-    }
 
-    bool Alive::is_pending_removal() const
-    {
-        return health > 0;
+        std::printf("  %zu matches, created in %.3f ms\n", query.size(), create_ms);
+        std::printf("  scan:     %8.3f ms/iteration\n", scan_ms);
+        std::printf("  query:    %8.3f ms/iteration\n", query_ms);
+        std::printf("  parallel: %8.3f ms/iteration\n", parallel_ms);
     }
 
-    bool Alive::delete_owner() const
+    struct Benchmark
     {
-        return health > 10;
-    }
-
+        const char* name;
+        void (*run)();
+    };
 
-    // ------------------------------------------------------------------------
-    // EntitySystemWithPrio
+    constexpr Benchmark benchmarks[] =
+    {
+        {"world-update", world_update},
+        {"world-update-tiers", world_update_tiers},
+        {"archetype-iteration", archetype_iteration},
+        {"component-pool", component_pool},
+        {"world-snapshot", world_snapshot},
+        {"world-query", world_query},
+        {"spatial-query", spatial_query}
+    };
 
-    EntitySystemWithPrio::EntitySystemWithPrio(EntitySystem* s, int p)
-        : system(s)
-        , prio(p)
+    int run(std::string_view name)
     {
+        bool found = false;
+        for(const auto& b: benchmarks)
+        {
+            if(name.empty() == false && name != b.name) { continue; }
+            found = true;
+            std::printf("%s\n", b.name);
+            b.run();
+        }
+
+        if(found == false)
+        {
+            std::printf("unknown benchmark %s\n", std::string{name}.c_str());
+            return 1;
+        }
+        return 0;
     }
+}
 
+namespace test
+{
+    using namespace entity;
 
-    // ------------------------------------------------------------------------
-    // EntitySystemUpdateStageList
+    /// the systems write "owner:type" here when they are updated
+    std::vector<std::string> update_log;
 
-    void EntitySystemUpdateStageList::update(UpdateStage stage)
+    template<char Name>
+    struct OrderSystem : EntitySystem
     {
-        for(auto& es: systems)
+        const char* owner = "";
+
+        RequestedComponents get_component_requests() override { return {}; }
+
+        void register_updates(EntitySystemUpdate* updates) override
         {
-            es.system->update(stage);
+            updates->add(this, UpdateStage::before_physics, 0);
         }
-    }
 
-    void EntitySystemUpdateStageList::add(EntitySystem* sys, int prio)
-    {
-        systems.emplace_back(sys, prio);
-        std::sort(systems.begin(), systems.end(), [](const auto& lhs, const auto& rhs)
+        void update(UpdateStage, float) override
         {
-            return lhs.prio < rhs.prio;
-        });
-    }
-
-    void EntitySystemUpdateStageList::remove(EntitySystem* sys)
-    {
-        core::update_and_erase(&systems,
-            [sys](const EntitySystemWithPrio& es)
-            { return es.system == sys;}
-        );
-    }
+            update_log.emplace_back(std::string{owner} + ":" + Name);
+        }
 
+        void component_was_added(Component*) override {}
+        void component_was_removed(Component*) override {}
+    };
 
-    // ------------------------------------------------------------------------
-    // EntitySystemUpdate
+    const EntitySystemTypeOf<OrderSystem<'a'>> order_a_type{"test-order-a"};
+    const EntitySystemTypeOf<OrderSystem<'b'>> order_b_type{"test-order-b"};
 
-    void EntitySystemUpdate::update(UpdateStage stage)
+    bool check(bool ok, const char* what)
     {
-        systems[static_cast<std::size_t>(stage)].update(stage);
+        if(ok == false) { std::printf("FAILED: %s\n", what); }
+        return ok;
     }
 
-    void EntitySystemUpdate::add(EntitySystem* sys, UpdateStage stage, int prio)
+    template<char Name>
+    void add_order_system(Entity* ent, const EntitySystemTypeOf<OrderSystem<Name>>& type, const char* owner)
     {
-        systems[static_cast<std::size_t>(stage)].add(sys, prio);
+        auto sys = type.create();
+        static_cast<OrderSystem<Name>*>(sys.get())->owner = owner;
+        ent->local_systems.emplace_back(std::move(sys));
     }
 
-    void EntitySystemUpdate::remove(EntitySystem* sys, UpdateStage stage)
+    std::unique_ptr<Entity> make_spatial_entity()
     {
-        systems[static_cast<std::size_t>(stage)].remove(sys);
+        auto spatial = spatial_component_type.create();
+        auto ent = std::make_unique<Entity>();
+        ent->root_component = static_cast<SpatialComponent*>(spatial.get());
+        ent->components.emplace_back(std::move(spatial));
+        return ent;
     }
 
+    /// all systems of a parent are updated before the child systems with the same prio,
+    /// and the systems of a entity are updated in registration order and not by type name
+    bool update_order_parent_before_child()
+    {
+        World world;
 
-    // ------------------------------------------------------------------------
-    // ComponentType
+        // the child is spawned first so the world order isn't parent first by accident
+        auto child = make_spatial_entity();
+        add_order_system(child.get(), order_a_type, "child");
+        add_order_system(child.get(), order_b_type, "child");
+        Entity* c = world.add(std::move(child));
 
-    // ------------------------------------------------------------------------
-    // ComponentFactory
-    void ComponentFactory::add(const ComponentType* ty)
-    {
-        types.insert({ty->name, ty});
+        auto parent = make_spatial_entity();
+        add_order_system(parent.get(), order_b_type, "parent");
+        add_order_system(parent.get(), order_a_type, "parent");
+        Entity* p = world.add(std::move(parent));
+
+        attach(&world, p->handle, c->handle);
+
+        update_log.clear();
+        for(unsigned int stage=0; stage<UpdateStageCount; stage+=1)
+        {
+            world.update(static_cast<UpdateStage>(stage), 1.0f / 60.0f);
+        }
+
+        const std::vector<std::string> expected = {"parent:b", "parent:a", "child:a", "child:b"};
+        return check(update_log == expected, "update order is parent before child and in registration order");
     }
-    
-    const ComponentType* ComponentFactory::from_name_or_null(core::HashedStringView name) const
+
+    struct TestHealth : Component
     {
-        auto found = types.find(name);
-        if(found != types.end()) { return found->second; }
-        else { return nullptr; }
-    }
+        float health = 100.0f;
 
-    // ------------------------------------------------------------------------
-    // EntitySystemType
+        void save(SnapshotWriter* writer) const override { writer->write(health); }
+        bool load(SnapshotReader* reader, std::uint32_t) override { return reader->read(&health); }
+    };
+    const ComponentTypeOf<TestHealth> test_health_type{"test-health"};
 
-    // ------------------------------------------------------------------------
-    // EntitySystemFactory
-    void EntitySystemFactory::add(const EntitySystemType* ty)
+    Entity* add_health_entity(World* world, float health)
     {
-        types.insert({ty->name, ty});
+        auto ent = make_spatial_entity();
+        auto c = test_health_type.create();
+        static_cast<TestHealth*>(c.get())->health = health;
+        ent->components.emplace_back(std::move(c));
+        return world->add(std::move(ent));
     }
 
-    const EntitySystemType* EntitySystemFactory::from_name_or_null(core::HashedStringView name)
+    float get_health(const Entity* ent)
     {
-        auto found = types.find(name);
-        if(found != types.end()) { return found->second; }
-        else { return nullptr; }
+        return static_cast<const TestHealth*>(ent->components[1].get())->health;
     }
 
-    // ------------------------------------------------------------------------
-    // WorldSystemType
-
-    // ------------------------------------------------------------------------
-    // WorldSystemFactory
-    void WorldSystemFactory::add(const WorldSystemType* ty)
+    bool is_attached_to(const Entity* child, const Entity* parent)
     {
-        types.insert({ty->name, ty});
+        return resolve(child->root_component->get_parent()) == parent;
     }
 
-    const WorldSystemType* WorldSystemFactory::from_name_or_null(core::HashedStringView name)
+    /// a snapshot loaded into a empty world recreates the entities and the attachments
+    bool snapshot_into_new_world()
     {
-        auto found = types.find(name);
-        if(found != types.end()) { return found->second; }
-        else { return nullptr; }
+        World world;
+        Entity* parent = add_health_entity(&world, 1.0f);
+        Entity* child = add_health_entity(&world, 2.0f);
+        attach(&world, parent->handle, child->handle);
+
+        Snapshot snapshot;
+        world.save_snapshot(&snapshot);
+
+        ComponentFactory factory;
+        factory.add(&spatial_component_type);
+        factory.add(&test_health_type);
+
+        World loaded;
+        bool ok = check(loaded.restore_snapshot(snapshot) == false, "restoring into a new world requires a factory");
+        ok = check(loaded.restore_snapshot(snapshot, &factory), "restore into a new world") && ok;
+
+        const auto& ents = loaded.get_entities();
+        if(check(ents.size() == 2, "all entities are recreated") == false) { return false; }
+        ok = check(get_health(ents[0].get()) == 1.0f && get_health(ents[1].get()) == 2.0f, "the component state is loaded") && ok;
+        ok = check(is_attached_to(ents[1].get(), ents[0].get()), "the child is attached to the parent") && ok;
+        return ok;
     }
 
-
-    // ------------------------------------------------------------------------
-    // Entity
-
-    void Entity::update(UpdateStage stage)
+    /// rolling back restores destroyed entities, destroys spawned entities and keeps the handles of the survivors
+    bool snapshot_rollback_across_spawn_and_destroy()
     {
-        systems.update(stage);
-
-        if(stage == UpdateStage::end_frame)
+        ComponentFactory factory;
+        factory.add(&spatial_component_type);
+        factory.add(&test_health_type);
+
+        World world;
+        Entity* kept = add_health_entity(&world, 1.0f);
+        Entity* destroyed = add_health_entity(&world, 2.0f);
+        attach(&world, kept->handle, destroyed->handle);
+        const EntityHandle kept_handle = kept->handle;
+
+        Snapshot snapshot;
+        world.save_snapshot(&snapshot);
+
+        static_cast<TestHealth*>(kept->components[1].get())->health = 10.0f;
+        world.get_commands().spawn(make_spatial_entity());
+        world.get_commands().destroy(destroyed->handle);
+        for(unsigned int stage=0; stage<UpdateStageCount; stage+=1)
         {
-            alive.update_for_frame();
-            update_and_remove_alives(&components, &dead_components);
+            world.update(static_cast<UpdateStage>(stage), 1.0f / 60.0f);
         }
-    }
-
-    // ------------------------------------------------------------------------
-    // Component
 
-    // ------------------------------------------------------------------------
-    // SpatialComponent
+        bool ok = check(world.restore_snapshot(snapshot, &factory), "rollback");
 
-    void attach(World* world, Entity* parent, Entity* child)
-    {
-        assert(parent->is_spatial_entity() && child->is_spatial_entity());
-        // todo(Gustav): implement attachments
+        const auto& ents = world.get_entities();
+        if(check(ents.size() == 2, "the spawned entity is destroyed and the destroyed is recreated") == false) { return false; }
+        ok = check(ents[0]->handle == kept_handle, "the surviving entity keeps the handle") && ok;
+        ok = check(get_health(ents[0].get()) == 1.0f && get_health(ents[1].get()) == 2.0f, "the component state is loaded") && ok;
+        ok = check(is_attached_to(ents[1].get(), ents[0].get()), "the recreated entity is attached again") && ok;
+        return ok;
     }
 
-    // ------------------------------------------------------------------------
-    // RequestedComponents
-
-    // ------------------------------------------------------------------------
-    // EntitySystem
-
-    // ------------------------------------------------------------------------
-    // WorldSystem
-
-    // ------------------------------------------------------------------------
-    // WorldSystemWithPrio
-    WorldSystemWithPrio::WorldSystemWithPrio(WorldSystem* s, int p)
-        : system(s)
-        , prio(p)
+    /// destroyed entities are swapped with the last entity and the moved entity knows where it is
+    bool destroy_keeps_world_index()
     {
-    }
+        World world;
+        std::vector<EntityHandle> handles;
+        for(int index=0; index<100; index+=1)
+        {
+            handles.emplace_back(world.add(make_spatial_entity())->handle);
+        }
 
-    // ------------------------------------------------------------------------
-    // WorldSystemUpdateStageList
-    void WorldSystemUpdateStageList::update(UpdateStage stage)
-    {
-        for(auto& es: systems)
+        for(std::size_t index=0; index<handles.size(); index+=2)
         {
-            es.system->update(stage);
+            world.get_commands().destroy(handles[index]);
+        }
+        for(unsigned int stage=0; stage<UpdateStageCount; stage+=1)
+        {
+            world.update(static_cast<UpdateStage>(stage), 1.0f / 60.0f);
         }
-    }
 
-    void WorldSystemUpdateStageList::add(WorldSystem* sys, int prio)
-    {
-        systems.emplace_back(sys, prio);
-        std::sort(systems.begin(), systems.end(), [](const auto& lhs, const auto& rhs)
+        const auto& ents = world.get_entities();
+        bool ok = check(ents.size() == 50, "every other entity is destroyed");
+        for(std::size_t index=0; index<ents.size(); index+=1)
         {
-            return lhs.prio < rhs.prio;
-        });
+            ok = check(ents[index]->world_index == index, "world index matches the position in the world") && ok;
+        }
+        return ok;
     }
 
-    void WorldSystemUpdateStageList::remove(WorldSystem* sys)
+    /// counts the lifetime hooks of the TestHooks components
+    struct HookLog
     {
-        swap_back_and_erase(&systems, [sys](const WorldSystemWithPrio& es) { return es.system == sys;});
-    }
-
-    // ------------------------------------------------------------------------
-    // WorldSystemUpdate
+        int initialized = 0;
+        int shutdown = 0;
+        int unloaded = 0;
+    };
 
-    void WorldSystemUpdate::update(UpdateStage stage)
+    struct TestHooks : Component
     {
-        systems[static_cast<std::size_t>(stage)].update(stage);
-    }
+        HookLog* log = nullptr;
 
-    void WorldSystemUpdate::add(WorldSystem* system, UpdateStage stage, int prio)
-    {
-        systems[static_cast<std::size_t>(stage)].add(system, prio);
-    }
+        void on_initialize() override { log->initialized += 1; }
+        void on_shutdown() override { log->shutdown += 1; }
+        void on_unload() override { log->unloaded += 1; }
+    };
+    const ComponentTypeOf<TestHooks> test_hooks_type{"test-hooks"};
 
-    void WorldSystemUpdate::remove(WorldSystem* system, UpdateStage stage)
+    ComponentPtr make_hooks_component(HookLog* log)
     {
-        systems[static_cast<std::size_t>(stage)].remove(system);
+        auto c = test_hooks_type.create();
+        static_cast<TestHooks*>(c.get())->log = log;
+        return c;
     }
 
-    // ------------------------------------------------------------------------
-    // World
-
-    void World::update(UpdateStage stage)
+    /// commands recorded against a entity that is destroyed earlier in the same frame are dropped
+    bool commands_after_destroy_are_ignored()
     {
-        // todo(Gustav): implement threading for entity
-        // todo(Gustav): take care of updating parent before child
-        // parallelized, spatial parent is updated before child (worker threads: nuber of cores - 1)
-        // place attached entities on the same thread as parent, schedule parent to update before the child
-        for(auto& ent: entities)
+        World world;
+        Entity* parent = world.add(make_spatial_entity());
+        Entity* target = add_health_entity(&world, 1.0f);
+        const EntityHandle target_handle = target->handle;
+        const ComponentHandle health_handle = target->components[1]->handle;
+
+        HookLog log;
+        auto& commands = world.get_commands();
+        commands.destroy(target_handle);
+        commands.add_component(target_handle, make_hooks_component(&log));
+        commands.remove_component(target_handle, health_handle);
+        commands.attach(parent->handle, target_handle);
+        for(unsigned int stage=0; stage<UpdateStageCount; stage+=1)
         {
-            ent->update(stage);
+            world.update(static_cast<UpdateStage>(stage), 1.0f / 60.0f);
         }
-        
-        // todo(Gustav): implement threading for world
-        // sequential, can use worker threads if needed
-        system_update.update(stage);
-    }
-
 
-    
+        bool ok = check(world.get_entities().size() == 1, "the entity is destroyed");
+        ok = check(resolve(target_handle) == nullptr, "the destroyed entity doesn't resolve") && ok;
+        ok = check(resolve(health_handle) == nullptr, "the components of the destroyed entity don't resolve") && ok;
+        ok = check(log.initialized == 0, "no component is added to the destroyed entity") && ok;
+        // the reclaim ring keeps the entity around for a few frames so it's still safe to look at
+        ok = check(target->components.size() == 2, "no component is removed from the destroyed entity") && ok;
+        ok = check(is_attached_to(target, parent) == false, "the destroyed entity isn't attached") && ok;
+        return ok;
+    }
 
-    ///////////////////////////////////////////////////////////////////////////////////////////////
-    // Examples
-#if 0
-    namespace example
+    /// destroying a entity shuts down and unloads the components like removing them does
+    bool destroy_runs_shutdown_hooks()
     {
-        struct Skeleton {};
-        struct Pose {};
-
-        struct AnimationGraphComponent
-        {
-            Skeleton* skeleton;
-            Pose calc_pose();
-        };
-        struct SkeletalMeshComponent
-        {
-            // property: MeshResource(defines skeleton, bindpose, inverse bindpose)
-            // init/shutdown: allocate pose storage based on mesh
-
-            Skeleton* skeleton;
-            void set_pose(const Pose& pose);
-        };
-
-        /** Example demonstrating a EnitySystem.
-         * * Animation system is repsonsible for executing animation tasks and trasferring
-         * the results to the skeletal mesh component
-         * * Domain specific logic sis kept within the indivual components
-         * * The logic for what updates and what data to transfer is in the system.
-        */
-        struct SimpleSingleAnimationSystem : EntitySystem
+        World world;
+        HookLog log;
+        auto ent = make_spatial_entity();
+        ent->components.emplace_back(make_hooks_component(&log));
+        const EntityHandle handle = world.add(std::move(ent))->handle;
+
+        world.get_commands().destroy(handle);
+        for(unsigned int stage=0; stage<UpdateStageCount; stage+=1)
         {
-            AnimationGraphComponent* animation_graph;
-            SkeletalMeshComponent* mesh;
-
-            void update(UpdateStage) override
-            {
-                if(animation_graph->skeleton == mesh->skeleton)
-                {
-                    mesh->set_pose(animation_graph->calc_pose());
-                }
-            }
-        };
+            world.update(static_cast<UpdateStage>(stage), 1.0f / 60.0f);
+        }
 
-        /// can have multiple meshes, or let the animationgraph return multiple poses/skeletons (custmization system)
-        struct SimpleMultiAnimationSystem : EntitySystem
-        {
-            AnimationGraphComponent* animation_graph;
-            std::vector<SkeletalMeshComponent*> meshes;
+        bool ok = check(log.initialized == 1, "the component is initialized when added");
+        ok = check(log.shutdown == 1, "the component is shut down when the entity is destroyed") && ok;
+        ok = check(log.unloaded == 1, "the component is unloaded when the entity is destroyed") && ok;
+        return ok;
+    }
 
-            void update(UpdateStage) override
-            {
-                auto pose = animation_graph->calc_pose();
-                for(SkeletalMeshComponent* mesh: meshes)
-                {
-                    if(animation_graph->skeleton == mesh->skeleton)
-                    {
-                        mesh->set_pose(pose);
-                    }
-                }
-            }
-        };
+    int run()
+    {
+        bool ok = true;
+        ok = update_order_parent_before_child() && ok;
+        ok = snapshot_into_new_world() && ok;
+        ok = snapshot_rollback_across_spawn_and_destroy() && ok;
+        ok = destroy_keeps_world_index() && ok;
+        ok = commands_after_destroy_are_ignored() && ok;
+        ok = destroy_runs_shutdown_hooks() && ok;
+        std::printf("%s\n", ok ? "all tests passed" : "tests failed");
+        return ok ? 0 : 1;
     }
-#endif
 }
 
-int main(int arc, char** argv)
+int main(int argc, char** argv)
 {
+    if(argc > 1 && std::string_view{argv[1]} == "bench")
+    {
+        return bench::run(argc > 2 ? argv[2] : "");
+    }
+    if(argc > 1 && std::string_view{argv[1]} == "test")
+    {
+        return test::run();
+    }
     return 0;
 }